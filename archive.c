@@ -0,0 +1,432 @@
+/********************************************************************************
+*	SYX2INS archive input						*
+*									*
+*	See archive.h. Zip archives are read through their central	*
+*	directory, tar archives header by header (ustar, GNU long names	*
+*	and pax path records).						*
+********************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+#include "archive.h"
+
+#define TAR_BLOCK           512
+
+static unsigned get16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned long get32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+int archiveIsArchive(const char *name)
+{
+    static const char *extensions[] = { ".zip", ".tar", ".tgz", ".tar.gz" };
+    size_t len = strlen(name), extLen;
+    int i;
+
+    for (i = 0; i < (int)(sizeof(extensions) / sizeof(*extensions)); i++)
+    {
+        extLen = strlen(extensions[i]);
+        if (len > extLen && !strcasecmp(name + len - extLen, extensions[i]))
+            return 1;
+    }
+    return 0;
+}
+
+static int addMember(Archive *archive, int *capacity, const char *name, size_t nameLen)
+{
+    ArchiveMember *grown;
+    ArchiveMember *member;
+
+    if (archive->nMembers == *capacity)
+    {
+        *capacity = *capacity ? *capacity * 2 : 256;
+        grown = realloc(archive->members, *capacity * sizeof(*grown));
+        if (!grown)
+            return 0;
+        archive->members = grown;
+    }
+    member = &archive->members[archive->nMembers];
+    memset(member, 0, sizeof(*member));
+    member->name = malloc(nameLen + 1);
+    if (!member->name)
+        return 0;
+    memcpy(member->name, name, nameLen);
+    member->name[nameLen] = 0;
+    archive->nMembers++;
+    return 1;
+}
+
+/* ********************************************************************* */
+/* Zip. The central directory at the end lists every member with its sizes and
+where its local header is, the data follows the local header's name and extra
+field, whose lengths can differ from the central directory's. */
+
+#define ZIP_LOCAL_SIG       0x04034b50
+#define ZIP_CENTRAL_SIG     0x02014b50
+#define ZIP_END_SIG         0x06054b50
+#define ZIP_END_SIZE        22
+#define DEFLATE_MAX_RATIO   1032        //Deflate can't shrink data more than this
+
+static int readZip(Archive *archive)
+{
+    const unsigned char *data = archive->data, *end = 0, *p, *local;
+    size_t size = archive->size, pos, dirOffset, dirEnd, nameLen, offset;
+    unsigned nEntries, i, flags, method;
+    int capacity = 0;
+    ArchiveMember *member;
+
+    /* The end record is the last thing in the file, followed only by a comment of up to 64 KB */
+    if (size < ZIP_END_SIZE)
+        return 0;
+    for (pos = size - ZIP_END_SIZE; !end; pos--)
+    {
+        if (get32(data + pos) == ZIP_END_SIG && pos + ZIP_END_SIZE + get16(data + pos + 20) == size)
+            end = data + pos;
+        if (pos == 0 || size - pos > 65535 + ZIP_END_SIZE)
+            break;
+    }
+    if (!end)
+        return 0;
+
+    nEntries = get16(end + 10);
+    dirOffset = get32(end + 16);
+    dirEnd = dirOffset + get32(end + 12);
+    /* Zip64 archives put all ones here and the real values elsewhere, a bank collection never needs one */
+    if (dirEnd > (size_t)(end - data))
+        return 0;
+
+    for (i = 0, pos = dirOffset; i < nEntries; i++)
+    {
+        p = data + pos;
+        if (pos + 46 > dirEnd || get32(p) != ZIP_CENTRAL_SIG)
+            return 0;
+        nameLen = get16(p + 28);
+        if (pos + 46 + nameLen > dirEnd)
+            return 0;
+        flags = get16(p + 8);
+        method = get16(p + 10);
+        offset = get32(p + 42);
+
+        /* Directories are listed with a trailing slash */
+        if (nameLen && p[46 + nameLen - 1] != '/')
+        {
+            if (!addMember(archive, &capacity, (const char *)p + 46, nameLen))
+                return 0;
+            member = &archive->members[archive->nMembers - 1];
+            member->crc = get32(p + 16);
+            member->haveCrc = 1;
+            member->storedSize = get32(p + 20);
+            member->size = get32(p + 24);
+            member->method = flags & 1 ? ARCHIVE_UNSUPPORTED
+                : method == 0 ? ARCHIVE_STORED : method == 8 ? ARCHIVE_DEFLATED : ARCHIVE_UNSUPPORTED;
+
+            /* Sizes that can't be right for the method mark a damaged member. It
+            stays listed so loading it reports the damage instead of reading past it. */
+            if ((member->method == ARCHIVE_STORED && member->size != member->storedSize)
+                || (member->method == ARCHIVE_DEFLATED && member->size / DEFLATE_MAX_RATIO > member->storedSize))
+                member->method = ARCHIVE_UNSUPPORTED;
+
+            local = data + offset;
+            if (offset + 30 > size || get32(local) != ZIP_LOCAL_SIG)
+                return 0;
+            member->offset = offset + 30 + get16(local + 26) + get16(local + 28);
+            if (member->offset > size || member->storedSize > size - member->offset)
+                return 0;
+        }
+        pos += 46 + nameLen + get16(p + 30) + get16(p + 32);
+    }
+    return 1;
+}
+
+/* ********************************************************************* */
+/* Tar. Every member is a 512 byte header followed by its data padded to whole
+blocks. Names longer than the header holds come from a ustar prefix, a GNU 'L'
+record or a pax 'x' record just before the member. */
+
+static int isTarHeader(const unsigned char *block)
+{
+    unsigned long sum = 0, stored;
+    char *endp;
+    int i;
+
+    for (i = 0; i < TAR_BLOCK; i++)
+        sum += i >= 148 && i < 156 ? ' ' : block[i];
+    stored = strtoul((const char *)block + 148, &endp, 8);
+    return endp != (const char *)block + 148 && stored == sum;
+}
+
+/* Octal numbers are NUL or space terminated, GNU tar stores big ones in binary */
+static size_t tarNumber(const unsigned char *field, int len)
+{
+    size_t value = 0;
+    int i;
+
+    if (field[0] & 0x80)
+    {
+        for (i = 1; i < len; i++)
+            value = (value << 8) | field[i];
+        return value;
+    }
+    for (i = 0; i < len && field[i] == ' '; i++)
+        ;
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+        value = value * 8 + (field[i] - '0');
+    return value;
+}
+
+/* Find "path=" in a pax record block ("<length> path=<name>\n" records) */
+static int paxPath(const unsigned char *p, size_t size, const unsigned char **name, size_t *nameLen)
+{
+    const unsigned char *end = p + size, *key;
+    size_t length;
+
+    while (p < end)
+    {
+        for (length = 0, key = p; key < end && *key >= '0' && *key <= '9'; key++)
+            length = length * 10 + (*key - '0');
+        if (key == end || *key != ' ' || length == 0 || length > (size_t)(end - p))
+            return 0;
+        key++;
+        if (p + length - key > 5 && !memcmp(key, "path=", 5))
+        {
+            *name = key + 5;
+            *nameLen = p + length - 1 - *name;
+            return 1;
+        }
+        p += length;
+    }
+    return 0;
+}
+
+static int readTar(Archive *archive)
+{
+    const unsigned char *data = archive->data, *header, *longName = 0;
+    size_t size = archive->size, pos = 0, memberSize, longLen = 0, prefixLen, nameLen;
+    char name[256 + 1];
+    int capacity = 0;
+    ArchiveMember *member;
+
+    if (size < TAR_BLOCK || !isTarHeader(data))
+        return 0;
+
+    while (pos + TAR_BLOCK <= size)
+    {
+        header = data + pos;
+        /* A zero block ends the archive */
+        if (!header[0])
+            break;
+        if (!isTarHeader(header))
+            return 0;
+
+        memberSize = tarNumber(header + 124, 12);
+        pos += TAR_BLOCK;
+        if (memberSize > size - pos)
+            return 0;
+
+        switch (header[156])
+        {
+        case 'L':
+            longName = data + pos;
+            longLen = strnlen((const char *)longName, memberSize);
+            break;
+        case 'x':
+            if (!paxPath(data + pos, memberSize, &longName, &longLen))
+                longName = 0;
+            break;
+        case '0':
+        case 0:
+        case '7':
+            if (longName)
+            {
+                if (!addMember(archive, &capacity, (const char *)longName, longLen))
+                    return 0;
+            }
+            else
+            {
+                /* ustar splits long paths into a prefix and a name */
+                prefixLen = memcmp(header + 257, "ustar", 5) ? 0 : strnlen((const char *)header + 345, 155);
+                memcpy(name, header + 345, prefixLen);
+                if (prefixLen)
+                    name[prefixLen++] = '/';
+                nameLen = strnlen((const char *)header, 100);
+                memcpy(name + prefixLen, header, nameLen);
+                if (!addMember(archive, &capacity, name, prefixLen + nameLen))
+                    return 0;
+            }
+            member = &archive->members[archive->nMembers - 1];
+            member->offset = pos;
+            member->storedSize = member->size = memberSize;
+            member->method = ARCHIVE_STORED;
+            longName = 0;
+            break;
+        default:
+            /* Directories, links, devices and global pax headers have nothing to parse */
+            longName = 0;
+            break;
+        }
+        pos += (memberSize + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+    }
+    return 1;
+}
+
+/* ********************************************************************* */
+
+#define GUNZIP_GUESS_RATIO  16          //Most a .tar.gz buffer is sized ahead of the data
+#define GUNZIP_MAX_SIZE     ((size_t)64 << 20)  //Largest .tar.gz contents taken
+
+/* Inflate a whole .tar.gz. The gzip trailer holds the unpacked size (modulo
+4 GB), a first guess for the buffer as long as the data could really grow that
+much. Anything unpacking to more than GUNZIP_MAX_SIZE is refused. */
+static int gunzip(Archive *archive)
+{
+    const unsigned char *data = archive->file.data;
+    size_t size = archive->file.size, capacity, grownSize, limit;
+    unsigned char *buffer, *grown;
+    z_stream zs;
+    int result;
+
+    /* One byte over the limit tells a stream that fits exactly from one that doesn't */
+    limit = size > GUNZIP_MAX_SIZE / DEFLATE_MAX_RATIO ? GUNZIP_MAX_SIZE : size * DEFLATE_MAX_RATIO;
+    limit++;
+    capacity = get32(data + size - 4) + 1;
+    if (capacity / GUNZIP_GUESS_RATIO > size)
+        capacity = size * GUNZIP_GUESS_RATIO;
+    if (capacity < 65536)
+        capacity = 65536;
+    if (capacity > limit)
+        capacity = limit;
+    buffer = malloc(capacity);
+    if (!buffer)
+        return 0;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+    {
+        free(buffer);
+        return 0;
+    }
+    zs.next_in = (unsigned char *)data;
+    zs.avail_in = size;
+    zs.next_out = buffer;
+    zs.avail_out = capacity;
+
+    while ((result = inflate(&zs, Z_NO_FLUSH)) == Z_OK)
+    {
+        if (zs.avail_out)
+            continue;
+        if (capacity == limit)
+            break;
+        grownSize = capacity > limit / 2 ? limit : capacity * 2;
+        grown = realloc(buffer, grownSize);
+        if (!grown)
+            break;
+        buffer = grown;
+        zs.next_out = buffer + capacity;
+        zs.avail_out = grownSize - capacity;
+        capacity = grownSize;
+    }
+    inflateEnd(&zs);
+    if (result != Z_STREAM_END || zs.total_out == limit)
+    {
+        free(buffer);
+        return 0;
+    }
+
+    archive->unpacked = buffer;
+    archive->data = buffer;
+    archive->size = zs.total_out;
+    return 1;
+}
+
+int archiveOpen(Archive *archive, const char *path)
+{
+    const unsigned char *data;
+    int ok;
+
+    memset(archive, 0, sizeof(*archive));
+    if (!openInput(path, &archive->file))
+        return 0;
+    archive->path = strdup(path);
+    archive->data = data = archive->file.data;
+    archive->size = archive->file.size;
+
+    if (archive->size >= 4 && data[0] == 'P' && data[1] == 'K')
+        ok = readZip(archive);
+    else if (archive->size >= 18 && data[0] == 0x1F && data[1] == 0x8B)
+        ok = gunzip(archive) && readTar(archive);
+    else
+        ok = readTar(archive);
+
+    if (!ok)
+        archiveClose(archive);
+    return ok;
+}
+
+void archiveClose(Archive *archive)
+{
+    int i;
+
+    for (i = 0; i < archive->nMembers; i++)
+        free(archive->members[i].name);
+    free(archive->members);
+    free(archive->unpacked);
+    free(archive->path);
+    closeInput(&archive->file);
+    memset(archive, 0, sizeof(*archive));
+}
+
+int archiveLoad(const Archive *archive, int member, InputFile *input)
+{
+    const ArchiveMember *m = &archive->members[member];
+    unsigned char *buffer;
+    z_stream zs;
+    int result;
+
+    memset(input, 0, sizeof(*input));
+    if (m->method == ARCHIVE_STORED)
+    {
+        if (m->haveCrc && crc32(0, archive->data + m->offset, m->size) != m->crc)
+            return 0;
+        input->data = archive->data + m->offset;
+        input->size = m->size;
+        input->mapped = -1;
+        return 1;
+    }
+    if (m->method != ARCHIVE_DEFLATED)
+        return 0;
+
+    buffer = malloc(m->size ? m->size : 1);
+    if (!buffer)
+        return 0;
+
+    /* Zip members are raw deflate streams without a zlib header */
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+    {
+        free(buffer);
+        return 0;
+    }
+    zs.next_in = (unsigned char *)archive->data + m->offset;
+    zs.avail_in = m->storedSize;
+    zs.next_out = buffer;
+    zs.avail_out = m->size;
+    result = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+
+    if (result != Z_STREAM_END || zs.total_out != m->size || crc32(0, buffer, m->size) != m->crc)
+    {
+        free(buffer);
+        return 0;
+    }
+    input->data = buffer;
+    input->size = m->size;
+    input->mapped = 0;
+    return 1;
+}
@@ -0,0 +1,61 @@
+/********************************************************************************
+*	SYX2INS archive input						*
+*									*
+*	Bank collections usually come as zip or tar archives holding	*
+*	thousands of small dumps. An archive is opened once and its member	*
+*	list read, then every member can be handed to the parser straight	*
+*	from memory: tar members (also inside .tar.gz) and stored zip	*
+*	members in place, deflated zip members inflated with zlib into a	*
+*	buffer of their own. Nothing is extracted to disk.			*
+********************************************************************************/
+#ifndef SYX2INS_ARCHIVE_H
+#define SYX2INS_ARCHIVE_H
+
+#include <stddef.h>
+
+#include "fileio.h"
+
+typedef enum
+{
+    ARCHIVE_STORED,
+    ARCHIVE_DEFLATED,
+    ARCHIVE_UNSUPPORTED             //Other zip compression methods and encrypted members
+} ArchiveMethod;
+
+typedef struct
+{
+    char *name;                     //Path inside the archive
+    size_t offset;                  //Start of its data in Archive.data
+    size_t storedSize;              //Bytes it takes up in the archive
+    size_t size;                    //Bytes once unpacked
+    unsigned long crc;              //CRC-32 of the unpacked bytes
+    int haveCrc;                    //Zip members carry one, tar members don't
+    ArchiveMethod method;
+} ArchiveMember;
+
+typedef struct
+{
+    char *path;
+    InputFile file;
+    unsigned char *unpacked;        //Inflated .tar.gz, NULL for other archives
+    const unsigned char *data;      //Archive contents, file.data or unpacked
+    size_t size;
+    ArchiveMember *members;         //Regular files only, in archive order
+    int nMembers;
+} Archive;
+
+/* Nonzero if the name has an archive extension: .zip, .tar, .tgz or .tar.gz */
+int archiveIsArchive(const char *name);
+
+/* Open an archive and list its members. Returns 0 if it can't be read or isn't
+a zip or tar archive. */
+int archiveOpen(Archive *archive, const char *path);
+void archiveClose(Archive *archive);
+
+/* Get a member's contents for parsing. Deflated members are inflated into a
+buffer closeInput() frees, the others point into the archive, which has to stay
+open until they are closed. Returns 0 if the member is damaged, can't be
+unpacked or memory runs out. Safe to call from several threads at once. */
+int archiveLoad(const Archive *archive, int member, InputFile *input);
+
+#endif
@@ -0,0 +1,274 @@
+/********************************************************************************
+*	SYX2INS conversion cache						*
+*									*
+*	See cache.h. Records are small binary files named after a hash:	*
+*	r<key> parse results, i<path> input stamps, o<path> output stamps.	*
+********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+#define CACHE_MAGIC         0x43493253      //"S2IC"
+#define CACHE_FORMAT        1
+
+enum
+{
+    RECORD_RESULT = 1,
+    RECORD_INPUT,
+    RECORD_OUTPUT
+};
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t format;
+    uint32_t kind;
+    uint32_t size;                  //Payload bytes following the header
+    uint64_t key;
+} RecordHeader;
+
+/* What stat() said about a file the last time we looked at it */
+typedef struct
+{
+    uint64_t size;
+    uint64_t inode;
+    uint64_t device;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+} FileStamp;
+
+/* Input and output records: the stamp, the hash that went with it and the path
+itself so two paths with the same name hash can't be mixed up */
+typedef struct
+{
+    FileStamp stamp;
+    uint64_t hash;
+    char path[1024];
+} StampRecord;
+
+typedef struct
+{
+    int32_t status;
+    Syx2InsResult result;
+} ResultRecord;
+
+static void makeStamp(const struct stat *info, FileStamp *stamp)
+{
+    memset(stamp, 0, sizeof(*stamp));
+    stamp->size = info->st_size;
+    stamp->inode = info->st_ino;
+    stamp->device = info->st_dev;
+    stamp->mtimeSec = info->st_mtime;
+#if defined(__APPLE__)
+    stamp->mtimeNsec = info->st_mtimespec.tv_nsec;
+#else
+    stamp->mtimeNsec = info->st_mtim.tv_nsec;
+#endif
+}
+
+int cacheSameStat(const struct stat *a, const struct stat *b)
+{
+    FileStamp x, y;
+
+    makeStamp(a, &x);
+    makeStamp(b, &y);
+    return !memcmp(&x, &y, sizeof(x));
+}
+
+static char *recordPath(const ConversionCache *cache, char kind, uint64_t key)
+{
+    char *path = malloc(strlen(cache->dir) + 20);
+
+    sprintf(path, "%s/%c%016llx", cache->dir, kind, (unsigned long long)key);
+    return path;
+}
+
+int writeFileAtomic(const char *path, const void *data, size_t size)
+{
+    char *temp = malloc(strlen(path) + 8);
+    const char *p = data;
+    ssize_t got;
+    int fd, ok = 1;
+
+    sprintf(temp, "%s.XXXXXX", path);
+    fd = mkstemp(temp);
+    if (fd < 0)
+    {
+        free(temp);
+        return 0;
+    }
+
+    /* The whole file is in memory, so this is one write() unless the kernel takes less */
+    while (ok && size)
+    {
+        got = write(fd, p, size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        ok = got > 0;
+        if (ok)
+        {
+            p += got;
+            size -= got;
+        }
+    }
+    ok = close(fd) == 0 && ok;
+    /* mkstemp creates the file 0600, give it the usual permissions */
+    ok = ok && chmod(temp, 0644) == 0;
+    ok = ok && rename(temp, path) == 0;
+    if (!ok)
+        unlink(temp);
+    free(temp);
+    return ok;
+}
+
+static int loadRecord(const ConversionCache *cache, char kind, uint32_t type, uint64_t key, void *payload, uint32_t size)
+{
+    char *path = recordPath(cache, kind, key);
+    FILE *file = fopen(path, "rb");
+    RecordHeader header;
+    int ok;
+
+    free(path);
+    if (!file)
+        return 0;
+
+    ok = fread(&header, sizeof(header), 1, file) == 1
+        && header.magic == CACHE_MAGIC && header.format == CACHE_FORMAT
+        && header.kind == type && header.size == size && header.key == key
+        && fread(payload, size, 1, file) == 1;
+    fclose(file);
+    return ok;
+}
+
+static void storeRecord(const ConversionCache *cache, char kind, uint32_t type, uint64_t key, const void *payload, uint32_t size)
+{
+    char *path = recordPath(cache, kind, key);
+    unsigned char *record = malloc(sizeof(RecordHeader) + size);
+    RecordHeader header;
+
+    header.magic = CACHE_MAGIC;
+    header.format = CACHE_FORMAT;
+    header.kind = type;
+    header.size = size;
+    header.key = key;
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + sizeof(header), payload, size);
+
+    /* A cache that can't be written to only means the next run does the work again */
+    writeFileAtomic(path, record, sizeof(header) + size);
+
+    free(record);
+    free(path);
+}
+
+int cacheOpen(ConversionCache *cache, const char *dir, const char *options)
+{
+    struct stat info;
+    char version[32];
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+        return 0;
+    if (stat(dir, &info) != 0 || !S_ISDIR(info.st_mode))
+        return 0;
+
+    /* Results depend on the tool version, what resolving gives, the layout of the
+    result and the options */
+    sprintf(version, "%.2f/%d/%u", SYX2INS_VERSION, SYX2INS_RESULT_SCHEMA, (unsigned)sizeof(Syx2InsResult));
+    cache->dir = strdup(dir);
+    cache->optionsKey = syx2insHash(options, strlen(options), syx2insHash(version, strlen(version), SYX2INS_HASH_SEED));
+    return 1;
+}
+
+void cacheClose(ConversionCache *cache)
+{
+    free(cache->dir);
+    cache->dir = 0;
+}
+
+static int lookupStamp(const ConversionCache *cache, char kind, uint32_t type, const char *path, const struct stat *info, uint64_t *hash)
+{
+    StampRecord record;
+    FileStamp stamp;
+
+    if (strlen(path) >= sizeof(record.path))
+        return 0;
+    if (!loadRecord(cache, kind, type, syx2insHash(path, strlen(path), SYX2INS_HASH_SEED), &record, sizeof(record)))
+        return 0;
+
+    makeStamp(info, &stamp);
+    if (memcmp(&record.stamp, &stamp, sizeof(stamp)) || strcmp(record.path, path))
+        return 0;
+
+    *hash = record.hash;
+    return 1;
+}
+
+static void rememberStamp(const ConversionCache *cache, char kind, uint32_t type, const char *path, const struct stat *info, uint64_t hash)
+{
+    StampRecord record;
+
+    if (strlen(path) >= sizeof(record.path))
+        return;
+
+    memset(&record, 0, sizeof(record));
+    makeStamp(info, &record.stamp);
+    record.hash = hash;
+    strcpy(record.path, path);
+    storeRecord(cache, kind, type, syx2insHash(path, strlen(path), SYX2INS_HASH_SEED), &record, sizeof(record));
+}
+
+int cacheLookupInput(const ConversionCache *cache, const char *path, const struct stat *info, uint64_t *contentHash)
+{
+    return lookupStamp(cache, 'i', RECORD_INPUT, path, info, contentHash);
+}
+
+void cacheRememberInput(const ConversionCache *cache, const char *path, const struct stat *info, uint64_t contentHash)
+{
+    rememberStamp(cache, 'i', RECORD_INPUT, path, info, contentHash);
+}
+
+int cacheLoadResult(const ConversionCache *cache, uint64_t contentHash, int *status, Syx2InsResult *result)
+{
+    ResultRecord *record = malloc(sizeof(*record));
+    int ok = loadRecord(cache, 'r', RECORD_RESULT, contentHash ^ cache->optionsKey, record, sizeof(*record));
+
+    if (ok)
+    {
+        *status = record->status;
+        *result = record->result;
+    }
+    free(record);
+    return ok;
+}
+
+void cacheStoreResult(const ConversionCache *cache, uint64_t contentHash, int status, const Syx2InsResult *result)
+{
+    ResultRecord *record = calloc(1, sizeof(*record));
+
+    record->status = status;
+    if (status == SYX2INS_OK)
+        record->result = *result;
+    storeRecord(cache, 'r', RECORD_RESULT, contentHash ^ cache->optionsKey, record, sizeof(*record));
+    free(record);
+}
+
+int cacheOutputUnchanged(const ConversionCache *cache, const char *path, uint64_t outputHash)
+{
+    struct stat info;
+    uint64_t hash;
+
+    return stat(path, &info) == 0 && lookupStamp(cache, 'o', RECORD_OUTPUT, path, &info, &hash) && hash == outputHash;
+}
+
+void cacheRememberOutput(const ConversionCache *cache, const char *path, uint64_t outputHash)
+{
+    struct stat info;
+
+    if (stat(path, &info) == 0)
+        rememberStamp(cache, 'o', RECORD_OUTPUT, path, &info, outputHash);
+}
@@ -0,0 +1,54 @@
+/********************************************************************************
+*	SYX2INS conversion cache						*
+*									*
+*	Lets batch rebuilds skip inputs and outputs that haven't changed.	*
+*	Parse results are stored under a hash of the dump contents, the	*
+*	tool version and the output options. Two small records remember	*
+*	the last seen stat() of every input (and the hash it had) and of	*
+*	every output (and the hash of what was written to it), so an	*
+*	unchanged file costs one stat() and a lookup. Every record is	*
+*	written to a temporary file and renamed into place, so any number	*
+*	of workers or processes can share one cache directory.		*
+********************************************************************************/
+#ifndef SYX2INS_CACHE_H
+#define SYX2INS_CACHE_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "syx2ins.h"
+
+typedef struct
+{
+    char *dir;
+    uint64_t optionsKey;            //Tool version and output options mixed into every result key
+} ConversionCache;
+
+/* Open (and create if needed) a cache directory. options describes anything
+that changes the output, results stored under other options are never reused.
+Returns 0 if the directory can't be used. */
+int cacheOpen(ConversionCache *cache, const char *dir, const char *options);
+void cacheClose(ConversionCache *cache);
+
+/* Content hash of an input recorded by cacheRememberInput(), if the file still
+has the same size, inode and modification time. Returns 1 on a hit. */
+int cacheLookupInput(const ConversionCache *cache, const char *path, const struct stat *info, uint64_t *contentHash);
+void cacheRememberInput(const ConversionCache *cache, const char *path, const struct stat *info, uint64_t contentHash);
+
+/* 1 if two stat()s of a file look the same to cacheLookupInput(), so nothing
+changed it in between */
+int cacheSameStat(const struct stat *a, const struct stat *b);
+
+/* Parse results by content hash. status is the syx2insConvert() return value. */
+int cacheLoadResult(const ConversionCache *cache, uint64_t contentHash, int *status, Syx2InsResult *result);
+void cacheStoreResult(const ConversionCache *cache, uint64_t contentHash, int status, const Syx2InsResult *result);
+
+/* 1 if path still holds exactly what cacheRememberOutput() recorded with this hash */
+int cacheOutputUnchanged(const ConversionCache *cache, const char *path, uint64_t outputHash);
+void cacheRememberOutput(const ConversionCache *cache, const char *path, uint64_t outputHash);
+
+/* Write a whole file through a temporary file and rename() so readers never see
+it half written. Returns 0 on failure. */
+int writeFileAtomic(const char *path, const void *data, size_t size);
+
+#endif
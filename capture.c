@@ -0,0 +1,252 @@
+/********************************************************************************
+*	SYX2INS large capture scanning					*
+*									*
+*	See capture.h.							*
+********************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "capture.h"
+
+#define CHUNKS_PER_THREAD   4               //More chunks than threads so a slow one doesn't hold up the rest
+#define CHUNK_MIN           (1u << 20)
+
+/* One slice of the input and the messages that start in it */
+typedef struct
+{
+    size_t from, to;
+    Syx2InsMessage *messages;
+    size_t nMessages, capacity;
+    int failed;
+} FrameChunk;
+
+typedef struct
+{
+    const unsigned char *data;
+    size_t size;
+    FrameChunk *chunks;
+    int nChunks;
+    int nextChunk;
+    pthread_mutex_t lock;
+} FrameJob;
+
+static void frameChunk(const FrameJob *job, FrameChunk *chunk)
+{
+    Syx2InsMessage *grown;
+    size_t pos = chunk->from, next;
+
+    do
+    {
+        if (chunk->nMessages == chunk->capacity)
+        {
+            /* Dumps are mostly 256 byte messages, start from a guess near that */
+            chunk->capacity = chunk->capacity ? chunk->capacity * 2 : (chunk->to - chunk->from) / 256 + 64;
+            grown = realloc(chunk->messages, chunk->capacity * sizeof(*chunk->messages));
+            if (!grown)
+            {
+                chunk->failed = 1;
+                return;
+            }
+            chunk->messages = grown;
+        }
+
+        chunk->nMessages += syx2insFrameRange(job->data, job->size, pos, chunk->to,
+            chunk->messages + chunk->nMessages, chunk->capacity - chunk->nMessages, &next);
+        pos = next;
+    } while (pos < chunk->to);
+}
+
+static void *frameWorker(void *arg)
+{
+    FrameJob *job = arg;
+    int chunk;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&job->lock);
+        chunk = job->nextChunk < job->nChunks ? job->nextChunk++ : -1;
+        pthread_mutex_unlock(&job->lock);
+        if (chunk < 0)
+            break;
+        frameChunk(job, &job->chunks[chunk]);
+    }
+    return 0;
+}
+
+Syx2InsMessage *captureFrame(const unsigned char *data, size_t size, int nThreads, size_t *nMessages)
+{
+    FrameJob job;
+    pthread_t *threads;
+    Syx2InsMessage *messages = 0;
+    size_t total = 0, chunkSize;
+    int i, nStarted = 0, failed = 0;
+
+    *nMessages = 0;
+    if (nThreads < 1)
+        nThreads = 1;
+
+    job.data = data;
+    job.size = size;
+    job.nChunks = nThreads * CHUNKS_PER_THREAD;
+    chunkSize = size / job.nChunks + 1;
+    if (chunkSize < CHUNK_MIN)
+    {
+        chunkSize = CHUNK_MIN;
+        job.nChunks = (int)(size / chunkSize) + 1;
+    }
+    job.nextChunk = 0;
+    job.chunks = calloc(job.nChunks, sizeof(*job.chunks));
+    if (!job.chunks)
+        return 0;
+    for (i = 0; i < job.nChunks; i++)
+    {
+        job.chunks[i].from = i * chunkSize < size ? i * chunkSize : size;
+        job.chunks[i].to = (i + 1) * chunkSize < size ? (i + 1) * chunkSize : size;
+    }
+    pthread_mutex_init(&job.lock, 0);
+
+    /* The calling thread frames too, so one thread means no threads at all */
+    if (nThreads > job.nChunks)
+        nThreads = job.nChunks;
+    threads = calloc(nThreads, sizeof(*threads));
+    for (i = 1; i < nThreads; i++)
+        if (pthread_create(&threads[nStarted], 0, frameWorker, &job) == 0)
+            nStarted++;
+    frameWorker(&job);
+    for (i = 0; i < nStarted; i++)
+        pthread_join(threads[i], 0);
+    free(threads);
+    pthread_mutex_destroy(&job.lock);
+
+    /* Chunks are in file order and don't overlap, so merging is appending */
+    for (i = 0; i < job.nChunks; i++)
+    {
+        total += job.chunks[i].nMessages;
+        failed |= job.chunks[i].failed;
+    }
+    /* Never a zero size, finding nothing isn't a failure to report */
+    if (!failed)
+        messages = malloc((total ? total : 1) * sizeof(*messages));
+    if (messages)
+    {
+        for (i = 0; i < job.nChunks; i++)
+        {
+            memcpy(messages + *nMessages, job.chunks[i].messages, job.chunks[i].nMessages * sizeof(*messages));
+            *nMessages += job.chunks[i].nMessages;
+        }
+    }
+
+    for (i = 0; i < job.nChunks; i++)
+        free(job.chunks[i].messages);
+    free(job.chunks);
+    return messages;
+}
+
+void captureParse(Syx2InsState *state, const unsigned char *data, size_t size, int nThreads)
+{
+    Syx2InsMessage *messages;
+    size_t nMessages;
+
+    if (size < CAPTURE_PARALLEL_MIN || nThreads < 2)
+    {
+        syx2insParse(state, data, size);
+        return;
+    }
+
+    messages = captureFrame(data, size, nThreads, &nMessages);
+    if (!messages)
+    {
+        /* Out of memory for the message list, the serial parse needs none */
+        syx2insParse(state, data, size);
+        return;
+    }
+    syx2insApplyMessages(state, data, messages, nMessages);
+    free(messages);
+}
+
+/* Add the damaged messages of one upload to those of the ones before it */
+static void addDiagnostics(Syx2InsDiagnostics *into, const Syx2InsDiagnostics *from)
+{
+    unsigned long i;
+    int p;
+
+    for (p = 0; p < SYX2INS_NUM_PROBLEMS; p++)
+        into->counts[p] += from->counts[p];
+    for (i = 0; i < from->total && i < SYX2INS_MAX_DIAGNOSTICS; i++)
+        if (into->total + i < SYX2INS_MAX_DIAGNOSTICS)
+            into->first[into->total + i] = from->first[i];
+    into->total += from->total;
+}
+
+/* Apply one upload's messages and resolve the state as it is then into another
+bank, unless the upload isn't for an MT-32 or has nothing intact. Its damaged
+messages go with the bank and are added to earlier ones in *all. */
+static int applyUpload(Syx2InsState *state, const unsigned char *data, size_t size, const Syx2InsMessage *messages, size_t n,
+    int intact, Syx2InsDiagnostics *all, Syx2InsResult **banks, int *nBanks)
+{
+    Syx2InsResult *grown;
+    int ok = 1;
+
+    memset(&state->diagnostics, 0, sizeof(state->diagnostics));
+    syx2insApplyMessages(state, data, messages, n);
+    if (n && intact && syx2insIsMT32(data + messages[0].offset, size - messages[0].offset))
+    {
+        grown = realloc(*banks, (*nBanks + 1) * sizeof(**banks));
+        if (grown)
+        {
+            *banks = grown;
+            syx2insResolve(state, &grown[(*nBanks)++]);
+        }
+        ok = grown != 0;
+    }
+    addDiagnostics(all, &state->diagnostics);
+    return ok;
+}
+
+int captureUploads(Syx2InsState *state, const unsigned char *data, size_t size, int nThreads, Syx2InsResult **banks, int *nBanks)
+{
+    Syx2InsMessage *messages;
+    Syx2InsDiagnostics all;
+    size_t nMessages, i, start = 0;
+    int sawWrites = 0, isDisplay, intact = 0, ok;
+
+    *banks = 0;
+    *nBanks = 0;
+    messages = captureFrame(data, size, size < CAPTURE_PARALLEL_MIN ? 1 : nThreads, &nMessages);
+    if (!messages)
+        return 0;
+    all = state->diagnostics;
+
+    for (i = 0; i < nMessages; i++)
+    {
+        /* Damaged messages get reported when applied but don't start or end uploads */
+        if (messages[i].problem != SYX2INS_MESSAGE_OK)
+            continue;
+        isDisplay = messages[i].address >> 14 == 0x20;
+
+        /* A display write after memory writes starts the next upload. Whatever
+        came before is applied and kept as the previous upload's bank, and the
+        new display text gets to name the next one. */
+        if (isDisplay && sawWrites)
+        {
+            ok = applyUpload(state, data, size, messages + start, i - start, intact, &all, banks, nBanks);
+            start = i;
+            if (!ok)
+                break;
+            state->haveDisplay = 0;
+            sawWrites = 0;
+            intact = 0;
+        }
+        sawWrites |= !isDisplay;
+        intact++;
+    }
+
+    /* Without memory for another bank the rest is still applied, it just isn't
+    split any further */
+    applyUpload(state, data, size, messages + start, nMessages - start, intact, &all, banks, nBanks);
+    state->diagnostics = all;
+
+    free(messages);
+    return 1;
+}
@@ -0,0 +1,40 @@
+/********************************************************************************
+*	SYX2INS large capture scanning					*
+*									*
+*	Long MIDI monitor captures can be hundreds of megabytes holding	*
+*	many bank uploads. They are cut into chunks that are framed on	*
+*	several threads at once, the message lists are put back together	*
+*	in file order and then applied to the memory image one after	*
+*	another, so later writes still win exactly like a serial parse.	*
+*	Optionally every upload in the capture gets its own bank.		*
+********************************************************************************/
+#ifndef SYX2INS_CAPTURE_H
+#define SYX2INS_CAPTURE_H
+
+#include <stddef.h>
+
+#include "syx2ins.h"
+
+/* Inputs smaller than this are parsed serially, threads wouldn't pay off */
+#define CAPTURE_PARALLEL_MIN    (4u << 20)
+
+/* Frame every MT-32 DT1 message of data on up to nThreads threads. Returns a
+malloc()ed list in file order, empty with *nMessages 0 if there are none, or NULL
+if memory runs out. */
+Syx2InsMessage *captureFrame(const unsigned char *data, size_t size, int nThreads, size_t *nMessages);
+
+/* Parse a whole capture into state like syx2insParse(), framing it on several
+threads when it is big enough to be worth it */
+void captureParse(Syx2InsState *state, const unsigned char *data, size_t size, int nThreads);
+
+/* Parse a capture and resolve one bank per upload. An upload starts at a
+'write to display' message that follows memory writes, which is how games begin
+sending their bank. Each bank is what the MT-32 holds once that upload is done,
+titled with that upload's display text and carrying only that upload's damaged
+messages. Uploads that don't start with an MT-32 message or hold nothing intact get
+no bank. state ends up as after a normal parse. *banks is a malloc()ed array of
+*nBanks banks, NULL with *nBanks 0 if no upload made one. Returns 0 only if
+memory runs out, the capture wasn't parsed then. */
+int captureUploads(Syx2InsState *state, const unsigned char *data, size_t size, int nThreads, Syx2InsResult **banks, int *nBanks);
+
+#endif
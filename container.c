@@ -0,0 +1,327 @@
+/********************************************************************************
+*	SYX2INS input containers						*
+*									*
+*	See container.h.							*
+********************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+
+#include "container.h"
+#include "capture.h"
+
+const char *const containerNames[NUM_CONTAINERS] =
+{
+    "unknown file", "SysEx dump", "Standard MIDI File", "SCI patch resource"
+};
+
+/* ********************************************************************* */
+/* Standard MIDI Files. SysEx sits in the tracks as F0 events (F0, length, the
+rest of the message) and F7 events, which either carry the next packet of a
+message sent in parts or, outside of one, raw bytes to send as they are. Lengths
+and delta times are variable length numbers. The MT-32 gets the messages of all
+tracks in playing order, so they are collected with their tick first and applied
+sorted by it once every track has been read. */
+
+typedef struct
+{
+    unsigned long tick;
+    size_t offset, length;          //Where the message is in SmfCollector.bytes
+} SmfSysex;
+
+typedef struct
+{
+    SmfSysex *events;
+    size_t nEvents, eventCapacity;
+    unsigned char *bytes;           //Messages put back together with their F0
+    size_t nBytes, byteCapacity;
+    int failed;
+} SmfCollector;
+
+static int readNumber(const unsigned char **p, const unsigned char *end, unsigned long *value)
+{
+    int i;
+
+    *value = 0;
+    for (i = 0; i < 4 && *p < end; i++)
+    {
+        *value = (*value << 7) | (**p & 0x7F);
+        if (!(*(*p)++ & 0x80))
+            return 1;
+    }
+    return 0;
+}
+
+static void appendBytes(SmfCollector *c, const unsigned char *data, size_t size)
+{
+    unsigned char *grown;
+    size_t capacity;
+
+    if (c->nBytes + size > c->byteCapacity)
+    {
+        capacity = c->byteCapacity ? c->byteCapacity : 4096;
+        while (c->nBytes + size > capacity)
+            capacity *= 2;
+        grown = realloc(c->bytes, capacity);
+        if (!grown)
+        {
+            c->failed = 1;
+            return;
+        }
+        c->bytes = grown;
+        c->byteCapacity = capacity;
+    }
+    memcpy(c->bytes + c->nBytes, data, size);
+    c->nBytes += size;
+}
+
+static void addSysex(SmfCollector *c, unsigned long tick, size_t offset)
+{
+    SmfSysex *grown;
+
+    if (c->failed || offset == c->nBytes)
+        return;
+    if (c->nEvents == c->eventCapacity)
+    {
+        c->eventCapacity = c->eventCapacity ? c->eventCapacity * 2 : 256;
+        grown = realloc(c->events, c->eventCapacity * sizeof(*c->events));
+        if (!grown)
+        {
+            c->failed = 1;
+            return;
+        }
+        c->events = grown;
+    }
+    c->events[c->nEvents].tick = tick;
+    c->events[c->nEvents].offset = offset;
+    c->events[c->nEvents].length = c->nBytes - offset;
+    c->nEvents++;
+}
+
+/* Collect the SysEx of one MTrk chunk. A broken track ends where it breaks. */
+static void readTrack(SmfCollector *c, const unsigned char *p, const unsigned char *end, int sequential)
+{
+    static const unsigned char sysexStart = 0xF0;
+    unsigned long tick = 0, delta, length, openTick = 0;
+    unsigned char status, running = 0;
+    size_t open = 0;
+    int isOpen = 0;
+
+    while (p < end && !c->failed)
+    {
+        if (!readNumber(&p, end, &delta) || p >= end)
+            break;
+        /* Format 2 tracks are separate songs, they play one after another */
+        if (!sequential)
+            tick += delta;
+
+        if (*p & 0x80)
+            status = *p++;
+        else if (running)
+            status = running;
+        else
+            break;
+
+        if (status == 0xFF)
+        {
+            /* Meta event: type, length, data. 2F ends the track. */
+            running = 0;
+            if (p >= end)
+                break;
+            status = *p++;
+            if (!readNumber(&p, end, &length) || length > (unsigned long)(end - p))
+                break;
+            p += length;
+            if (status == 0x2F)
+                break;
+        }
+        else if (status == 0xF0 || status == 0xF7)
+        {
+            running = 0;
+            if (!readNumber(&p, end, &length) || length > (unsigned long)(end - p))
+                break;
+
+            if (status == 0xF0)
+            {
+                /* A message that never got its last packet is dropped */
+                if (isOpen)
+                    c->nBytes = open;
+                open = c->nBytes;
+                openTick = tick;
+                isOpen = 1;
+                appendBytes(c, &sysexStart, 1);
+                appendBytes(c, p, length);
+            }
+            else if (isOpen)
+                appendBytes(c, p, length);
+            else
+            {
+                /* Escape: the bytes go out as they are and may hold whole messages */
+                open = c->nBytes;
+                appendBytes(c, p, length);
+                addSysex(c, tick, open);
+            }
+
+            if (isOpen && length && p[length - 1] == 0xF7)
+            {
+                addSysex(c, openTick, open);
+                isOpen = 0;
+            }
+            p += length;
+        }
+        else if (status < 0xF0)
+        {
+            /* Channel message, running status leaves p on its first data byte */
+            running = status;
+            length = (status & 0xE0) == 0xC0 ? 1 : 2;      //Program change and channel pressure have one
+            if (length > (unsigned long)(end - p))
+                break;
+            p += length;
+        }
+        else
+            break;          //No other status byte belongs in a track
+    }
+
+    if (isOpen)
+        c->nBytes = open;
+}
+
+static int compareSysex(const void *a, const void *b)
+{
+    const SmfSysex *x = a, *y = b;
+
+    /* Same tick: the order they were read in, which is track order */
+    if (x->tick != y->tick)
+        return x->tick < y->tick ? -1 : 1;
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static unsigned long readBigEndian(const unsigned char *p, int n)
+{
+    unsigned long value = 0;
+
+    while (n--)
+        value = (value << 8) | *p++;
+    return value;
+}
+
+static int parseSMF(Syx2InsState *state, const unsigned char *data, size_t size)
+{
+    SmfCollector c;
+    size_t pos, i, length;
+    unsigned long before = state->nMessages;
+    int sequential = readBigEndian(data + 8, 2) == 2;
+
+    memset(&c, 0, sizeof(c));
+    for (pos = 8 + readBigEndian(data + 4, 4); pos + 8 <= size && pos >= 8; pos += 8 + length)
+    {
+        length = readBigEndian(data + pos + 4, 4);
+        if (!memcmp(data + pos, "MTrk", 4))
+            readTrack(&c, data + pos + 8, data + pos + 8 + (length < size - pos - 8 ? length : size - pos - 8), sequential);
+        if (length > size - pos - 8)
+            break;
+    }
+
+    if (!c.failed && c.nEvents)
+    {
+        qsort(c.events, c.nEvents, sizeof(*c.events), compareSysex);
+        for (i = 0; i < c.nEvents; i++)
+            syx2insParse(state, c.bytes + c.events[i].offset, c.events[i].length);
+    }
+
+    free(c.events);
+    free(c.bytes);
+    return !c.failed && state->nMessages > before;
+}
+
+/* ********************************************************************* */
+/* Sierra SCI patch.001. Not messages but the blocks the game's MT-32 driver
+sends, at fixed places after a two byte resource header:
+
+      0   20 bytes  display text once the upload is done
+     20   20 bytes  display text while uploading
+     40   20 bytes  goodbye text
+     60    3 bytes  master volume, reverb mode
+     63   44 bytes  reverb SysEx and settings
+    107  384 bytes  patches 1-48 (05 00 00)
+    491    1 byte   number of timbres, then that many 246 byte timbres (08 00 00)
+
+followed by optional blocks, each flagged by a big endian word: ABCD for patches
+49-96 (05 03 00), DCBA for the rhythm setup (03 01 10) and partial reserve
+(10 00 04). Volume and reverb don't change any names and are left out. */
+
+#define SCI_HEADER          2
+#define SCI_PATCH_TYPE      0x89            //Resource type 9 (patch), 0x80 marks the header
+#define SCI_PATCHES         (SCI_HEADER + 107)
+#define SCI_TIMBRE_COUNT    (SCI_HEADER + 491)
+#define SCI_PATCH_BLOCK     (48 * 8)
+#define TIMBRE_SIZE         246
+
+static int parseSCIPatch(Syx2InsState *state, const unsigned char *data, size_t size)
+{
+    size_t pos = SCI_TIMBRE_COUNT + 1;
+    int i, nTimbres = data[SCI_TIMBRE_COUNT];
+
+    /* The driver shows the 'while uploading' text first and the 'done' text
+    last, but only the first display write names the bank and the loading banner
+    is no name for it. The done text goes first and the banner is left out. */
+    syx2insWrite(state, SYX2INS_ADDRESS(0x20, 0x00, 0x00), data + SCI_HEADER, 20);
+    syx2insWrite(state, SYX2INS_ADDRESS(0x05, 0x00, 0x00), data + SCI_PATCHES, SCI_PATCH_BLOCK);
+
+    for (i = 0; i < nTimbres && i < 64 && pos + TIMBRE_SIZE <= size; i++, pos += TIMBRE_SIZE)
+        syx2insWrite(state, SYX2INS_ADDRESS(0x08, i * 2, 0x00), data + pos, TIMBRE_SIZE);
+
+    if (pos + 2 + SCI_PATCH_BLOCK <= size && data[pos] == 0xAB && data[pos + 1] == 0xCD)
+    {
+        syx2insWrite(state, SYX2INS_ADDRESS(0x05, 0x03, 0x00), data + pos + 2, SCI_PATCH_BLOCK);
+        pos += 2 + SCI_PATCH_BLOCK;
+    }
+    if (pos + 2 + 256 + 9 <= size && data[pos] == 0xDC && data[pos + 1] == 0xBA)
+    {
+        syx2insWrite(state, SYX2INS_ADDRESS(0x03, 0x01, 0x10), data + pos + 2, 256);
+        syx2insWrite(state, SYX2INS_ADDRESS(0x10, 0x00, 0x04), data + pos + 2 + 256, 9);
+    }
+    return 1;
+}
+
+/* ********************************************************************* */
+
+ContainerKind containerDetect(const unsigned char *data, size_t size)
+{
+    if (size >= 14 && !memcmp(data, "MThd", 4))
+        return CONTAINER_SMF;
+    if (size > SCI_TIMBRE_COUNT && data[0] == SCI_PATCH_TYPE && data[1] == 0)
+        return CONTAINER_SCI_PATCH;
+    /* Any SysEx will do, captures often start with some other device's */
+    if (size && data[0] == 0xF0)
+        return CONTAINER_SYX;
+    return CONTAINER_NONE;
+}
+
+int containerParse(ContainerKind kind, Syx2InsState *state, const unsigned char *data, size_t size, int nThreads)
+{
+    unsigned long before = state->nMessages;
+
+    switch (kind)
+    {
+    case CONTAINER_SYX:
+        captureParse(state, data, size, nThreads);
+        return state->nMessages > before;
+    case CONTAINER_SMF:
+        return parseSMF(state, data, size);
+    case CONTAINER_SCI_PATCH:
+        return parseSCIPatch(state, data, size);
+    default:
+        return 0;
+    }
+}
+
+int containerConvert(const unsigned char *data, size_t size, Syx2InsState *state, Syx2InsResult *result)
+{
+    ContainerKind kind = containerDetect(data, size);
+
+    syx2insReset(state);
+    if (!containerParse(kind, state, data, size, 1))
+        return SYX2INS_NOT_MT32;
+    syx2insResolve(state, result);
+    return SYX2INS_OK;
+}
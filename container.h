@@ -0,0 +1,40 @@
+/********************************************************************************
+*	SYX2INS input containers						*
+*									*
+*	Most MT-32 banks don't come as raw .SYX dumps but inside the	*
+*	files that send them: Standard MIDI Files carry them as F0/F7	*
+*	events in their tracks and Sierra's SCI games keep them in the	*
+*	patch.001 resource. These decoders walk such a file in place and	*
+*	hand what it would send the MT-32 straight to the parser, so no	*
+*	temporary .SYX file has to be extracted first.			*
+********************************************************************************/
+#ifndef SYX2INS_CONTAINER_H
+#define SYX2INS_CONTAINER_H
+
+#include <stddef.h>
+
+#include "syx2ins.h"
+
+typedef enum
+{
+    CONTAINER_NONE,                 //Nothing we can read
+    CONTAINER_SYX,                  //Raw SysEx dump or capture
+    CONTAINER_SMF,                  //Standard MIDI File
+    CONTAINER_SCI_PATCH,            //Sierra SCI MT-32 patch resource (patch.001)
+    NUM_CONTAINERS
+} ContainerKind;
+
+extern const char *const containerNames[NUM_CONTAINERS];
+
+/* Tell from the first bytes what kind of file data is */
+ContainerKind containerDetect(const unsigned char *data, size_t size);
+
+/* Apply everything the file sends to the MT-32 to state, in the order the unit
+would receive it. Raw dumps go through captureParse() with nThreads. Returns 0 if
+nothing in it was meant for an MT-32 or memory ran out. */
+int containerParse(ContainerKind kind, Syx2InsState *state, const unsigned char *data, size_t size, int nThreads);
+
+/* syx2insConvert() for any kind of file */
+int containerConvert(const unsigned char *data, size_t size, Syx2InsState *state, Syx2InsResult *result);
+
+#endif
@@ -0,0 +1,391 @@
+/********************************************************************************
+*	SYX2INS output formats						*
+*									*
+*	See emit.h. Names are at most 10 characters and titles 20, which	*
+*	is what makes the size bounds below cheap to work out.		*
+********************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "emit.h"
+
+static void append(OutputBuffer *out, const char *data, size_t size)
+{
+    if (out->size + size > out->capacity)
+    {
+        out->overflow = 1;
+        return;
+    }
+    memcpy(out->data + out->size, data, size);
+    out->size += size;
+}
+
+static void appendString(OutputBuffer *out, const char *text)
+{
+    append(out, text, strlen(text));
+}
+
+static void appendNumber(OutputBuffer *out, unsigned number)
+{
+    char digits[12];
+    int n = sizeof(digits);
+
+    do
+    {
+        digits[--n] = '0' + number % 10;
+        number /= 10;
+    } while (number);
+    append(out, digits + n, sizeof(digits) - n);
+}
+
+/* ********************************************************************* */
+/* Cakewalk/Sonar INS. Every bank gets its own entry under .Patch Names and its
+own instrument under .Instrument Definitions. Its rhythm setup becomes a list
+under .Note Names and a drum instrument of its own, meant for channel 10 where
+the MT-32 plays its rhythm part. */
+
+#define INS_RULE    "\n; ----------------------------------------------------------------------\n\n"
+
+static size_t insMaxSize(const Syx2InsResult *banks, int nBanks)
+{
+    (void)banks;
+    return 3 * 100 + (size_t)nBanks * (128 * (4 + 10 + 1) + SYX2INS_RHYTHM_KEYS * (4 + 10 + 1) + 10 * (20 + 40));
+}
+
+/* Key number of rhythm setup entry i */
+#define RHYTHM_KEY(i)   (24 + (i))
+
+static void insRender(OutputBuffer *out, const Syx2InsResult *banks, int nBanks)
+{
+    int b, i;
+
+    appendString(out, INS_RULE ".Patch Names\n\n");
+    for (b = 0; b < nBanks; b++)
+    {
+        appendString(out, "\n[");
+        appendString(out, banks[b].title);
+        appendString(out, " Patch Bank]\n");
+
+        for (i = 0; i < 128; i++)
+        {
+            appendNumber(out, i);
+            append(out, "=", 1);
+            appendString(out, banks[b].patchNames[i]);
+            append(out, "\n", 1);
+        }
+    }
+
+    appendString(out, INS_RULE ".Note Names\n\n");
+    for (b = 0; b < nBanks; b++)
+    {
+        appendString(out, "\n[");
+        appendString(out, banks[b].title);
+        appendString(out, " Rhythm]\n");
+
+        for (i = 0; i < SYX2INS_RHYTHM_KEYS; i++)
+        {
+            if (!banks[b].rhythmNames[i][0])
+                continue;
+            appendNumber(out, RHYTHM_KEY(i));
+            append(out, "=", 1);
+            appendString(out, banks[b].rhythmNames[i]);
+            append(out, "\n", 1);
+        }
+    }
+
+    appendString(out, INS_RULE ".Instrument Definitions\n\n");
+    for (b = 0; b < nBanks; b++)
+    {
+        appendString(out, "\n[");
+        appendString(out, banks[b].title);
+        appendString(out, " Patch Bank]\nPatch[*]=");
+        appendString(out, banks[b].title);
+        appendString(out, " Patch Bank\n");
+
+        appendString(out, "\n; Rhythm part, MIDI channel 10\n[");
+        appendString(out, banks[b].title);
+        appendString(out, " Rhythm]\nPatch[*]=");
+        appendString(out, banks[b].title);
+        appendString(out, " Patch Bank\nKey[*,*]=");
+        appendString(out, banks[b].title);
+        appendString(out, " Rhythm\nDrum[*,*]=1\n");
+    }
+}
+
+/* ********************************************************************* */
+/* JSON: { "banks": [ { "title", "device", "patches": [...], "timbres": [...],
+"rhythm": [...] } ] }. Patches and rhythm keys carry whether the dump set them,
+timbres are only the ones the dump wrote and rhythm keys the ones that play. */
+
+static void jsonString(OutputBuffer *out, const char *text)
+{
+    static const char hex[] = "0123456789abcdef";
+    char escape[6] = { '\\', 'u', '0', '0' };
+
+    append(out, "\"", 1);
+    for (; *text; text++)
+    {
+        unsigned char c = *text;
+
+        if (c == '"' || c == '\\')
+        {
+            escape[1] = c;
+            append(out, escape, 2);
+            escape[1] = 'u';
+        }
+        else if (c < 0x20)
+        {
+            escape[4] = hex[c >> 4];
+            escape[5] = hex[c & 15];
+            append(out, escape, 6);
+        }
+        else
+            append(out, text, 1);
+    }
+    append(out, "\"", 1);
+}
+
+static size_t jsonMaxSize(const Syx2InsResult *banks, int nBanks)
+{
+    (void)banks;
+    /* Every character can become a 6 byte \u escape */
+    return 32 + (size_t)nBanks * (256 + 20 * 6 + (192 + SYX2INS_RHYTHM_KEYS) * (64 + 10 * 6) + SYX2INS_RHYTHM_KEYS * 64);
+}
+
+static void jsonRender(OutputBuffer *out, const Syx2InsResult *banks, int nBanks)
+{
+    int b, i, first;
+
+    appendString(out, "{\n  \"banks\": [");
+    for (b = 0; b < nBanks; b++)
+    {
+        appendString(out, b ? ",\n    {\n      \"title\": " : "\n    {\n      \"title\": ");
+        jsonString(out, banks[b].title);
+        appendString(out, ",\n      \"device\": ");
+        jsonString(out, syx2insDevices[banks[b].device].name);
+
+        appendString(out, ",\n      \"patches\": [");
+        for (i = 0; i < 128; i++)
+        {
+            appendString(out, i ? ",\n        { \"number\": " : "\n        { \"number\": ");
+            appendNumber(out, i);
+            appendString(out, ", \"name\": ");
+            jsonString(out, banks[b].patchNames[i]);
+            appendString(out, banks[b].patchWritten[i] ? ", \"set\": true }" : ", \"set\": false }");
+        }
+
+        appendString(out, "\n      ],\n      \"timbres\": [");
+        for (i = 0, first = 1; i < 64; i++)
+        {
+            if (!banks[b].timbreWritten[i])
+                continue;
+            appendString(out, first ? "\n        { \"slot\": " : ",\n        { \"slot\": ");
+            appendNumber(out, i);
+            appendString(out, ", \"name\": ");
+            jsonString(out, banks[b].timbreNames[i]);
+            appendString(out, " }");
+            first = 0;
+        }
+
+        appendString(out, first ? "],\n      \"rhythm\": [" : "\n      ],\n      \"rhythm\": [");
+        for (i = 0, first = 1; i < SYX2INS_RHYTHM_KEYS; i++)
+        {
+            const unsigned char *key = banks[b].rhythmSetup[i];
+
+            if (!banks[b].rhythmNames[i][0])
+                continue;
+            appendString(out, first ? "\n        { \"key\": " : ",\n        { \"key\": ");
+            appendNumber(out, RHYTHM_KEY(i));
+            appendString(out, ", \"name\": ");
+            jsonString(out, banks[b].rhythmNames[i]);
+            appendString(out, ", \"level\": ");
+            appendNumber(out, key[1]);
+            appendString(out, ", \"pan\": ");
+            appendNumber(out, key[2]);
+            appendString(out, key[3] ? ", \"reverb\": true" : ", \"reverb\": false");
+            appendString(out, banks[b].rhythmWritten[i] ? ", \"set\": true }" : ", \"set\": false }");
+            first = 0;
+        }
+        appendString(out, first ? "]\n    }" : "\n      ]\n    }");
+    }
+    appendString(out, nBanks ? "\n  ]\n}\n" : "]\n}\n");
+}
+
+/* ********************************************************************* */
+/* CSV: bank,kind,number,name,set with text fields quoted */
+
+static void csvString(OutputBuffer *out, const char *text)
+{
+    append(out, "\"", 1);
+    for (; *text; text++)
+    {
+        if (*text == '"')
+            append(out, "\"", 1);
+        append(out, text, 1);
+    }
+    append(out, "\"", 1);
+}
+
+static size_t csvMaxSize(const Syx2InsResult *banks, int nBanks)
+{
+    (void)banks;
+    /* Quotes double, so every field can take twice its length plus two */
+    return 64 + (size_t)nBanks * (192 + SYX2INS_RHYTHM_KEYS) * (42 + 10 + 22 + 8);
+}
+
+static void csvRow(OutputBuffer *out, const char *title, const char *kind, int number, const char *name, int set)
+{
+    csvString(out, title);
+    append(out, ",", 1);
+    appendString(out, kind);
+    append(out, ",", 1);
+    appendNumber(out, number);
+    append(out, ",", 1);
+    csvString(out, name);
+    appendString(out, set ? ",1\r\n" : ",0\r\n");
+}
+
+static void csvRender(OutputBuffer *out, const Syx2InsResult *banks, int nBanks)
+{
+    int b, i;
+
+    appendString(out, "bank,kind,number,name,set\r\n");
+    for (b = 0; b < nBanks; b++)
+    {
+        for (i = 0; i < 128; i++)
+            csvRow(out, banks[b].title, "patch", i, banks[b].patchNames[i], banks[b].patchWritten[i]);
+        for (i = 0; i < 64; i++)
+            if (banks[b].timbreWritten[i])
+                csvRow(out, banks[b].title, "timbre", i, banks[b].timbreNames[i], 1);
+        for (i = 0; i < SYX2INS_RHYTHM_KEYS; i++)
+            if (banks[b].rhythmNames[i][0])
+                csvRow(out, banks[b].title, "rhythm", RHYTHM_KEY(i), banks[b].rhythmNames[i], banks[b].rhythmWritten[i]);
+    }
+}
+
+/* ********************************************************************* */
+/* SCI Companion: 128 names per bank, one per line in patch order. Banks after
+the first are separated by a blank line and a ; comment with their title. */
+
+static size_t sciMaxSize(const Syx2InsResult *banks, int nBanks)
+{
+    (void)banks;
+    return (size_t)nBanks * (128 * (10 + 1) + 20 + 4);
+}
+
+static void sciRender(OutputBuffer *out, const Syx2InsResult *banks, int nBanks)
+{
+    int b, i;
+
+    for (b = 0; b < nBanks; b++)
+    {
+        if (b)
+        {
+            appendString(out, "\n; ");
+            appendString(out, banks[b].title);
+            append(out, "\n", 1);
+        }
+        for (i = 0; i < 128; i++)
+        {
+            appendString(out, banks[b].patchNames[i]);
+            append(out, "\n", 1);
+        }
+    }
+}
+
+/* ********************************************************************* */
+
+const Emitter emitters[NUM_FORMATS] =
+{
+    { "ins", ".INS", insMaxSize, insRender },
+    { "json", ".json", jsonMaxSize, jsonRender },
+    { "csv", ".csv", csvMaxSize, csvRender },
+    { "sci", ".txt", sciMaxSize, sciRender }
+};
+
+int emitParseFormats(const char *list, unsigned *formats)
+{
+    const char *comma;
+    size_t length;
+    int f;
+
+    *formats = 0;
+    for (; *list; list = *comma ? comma + 1 : comma)
+    {
+        comma = strchr(list, ',');
+        if (!comma)
+            comma = list + strlen(list);
+        length = comma - list;
+
+        for (f = 0; f < NUM_FORMATS; f++)
+            if (strlen(emitters[f].name) == length && !memcmp(emitters[f].name, list, length))
+                break;
+        if (f == NUM_FORMATS)
+            return 0;
+        *formats |= FORMAT_MASK(f);
+    }
+    return *formats != 0;
+}
+
+int emitRender(OutputFormat format, const Syx2InsResult *banks, int nBanks, OutputBuffer *out)
+{
+    const Emitter *emitter = &emitters[format];
+
+    memset(out, 0, sizeof(*out));
+    out->capacity = emitter->maxSize(banks, nBanks);
+    out->data = malloc(out->capacity ? out->capacity : 1);
+    if (!out->data)
+        return 0;
+
+    emitter->render(out, banks, nBanks);
+    /* The bounds are worked out to never be hit, this would be a bug in them */
+    if (out->overflow)
+    {
+        emitFree(out);
+        return 0;
+    }
+    return 1;
+}
+
+void emitFree(OutputBuffer *out)
+{
+    free(out->data);
+    memset(out, 0, sizeof(*out));
+}
+
+int emitWrite(int fd, const OutputBuffer *out)
+{
+    size_t done = 0;
+    ssize_t got;
+
+    while (done < out->size)
+    {
+        got = write(fd, out->data + done, out->size - done);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return 0;
+        done += got;
+    }
+    return 1;
+}
+
+char *emitPath(const char *path, OutputFormat format)
+{
+    const char *base = path, *p, *dot;
+    size_t stemLen;
+    char *result;
+
+    for (p = path; *p; p++)
+        if (*p == '/' || *p == '\\')
+            base = p + 1;
+    dot = strrchr(base, '.');
+    stemLen = dot ? (size_t)(dot - path) : strlen(path);
+
+    result = malloc(stemLen + strlen(emitters[format].extension) + 1);
+    memcpy(result, path, stemLen);
+    strcpy(result + stemLen, emitters[format].extension);
+    return result;
+}
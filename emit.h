@@ -0,0 +1,71 @@
+/********************************************************************************
+*	SYX2INS output formats						*
+*									*
+*	Every format renders the same converted banks. An emitter first	*
+*	works out how big its output can get, the buffer is allocated once	*
+*	at that size, filled without any stdio calls and written out with	*
+*	a single write().							*
+*									*
+*	  ins    Cakewalk/Sonar instrument definitions			*
+*	  json   banks, patches, custom timbres and rhythm keys		*
+*	  csv    one row per patch, custom timbre and rhythm key		*
+*	  sci    plain patch name list for SCI Companion, line n is patch n-1	*
+********************************************************************************/
+#ifndef SYX2INS_EMIT_H
+#define SYX2INS_EMIT_H
+
+#include <stddef.h>
+
+#include "syx2ins.h"
+
+typedef enum
+{
+    FORMAT_INS,
+    FORMAT_JSON,
+    FORMAT_CSV,
+    FORMAT_SCI,
+    NUM_FORMATS
+} OutputFormat;
+
+#define FORMAT_MASK(format)     (1u << (format))
+
+/* Bump whenever an emitter's output changes for the same banks */
+#define EMIT_SCHEMA     3
+
+/* A fixed size output buffer. Appends past the end are dropped and flagged. */
+typedef struct
+{
+    char *data;
+    size_t size, capacity;
+    int overflow;
+} OutputBuffer;
+
+typedef struct
+{
+    const char *name;               //As given to -format
+    const char *extension;          //Replaces the output file's extension
+    /* Upper bound of the output size for these banks */
+    size_t (*maxSize)(const Syx2InsResult *banks, int nBanks);
+    void (*render)(OutputBuffer *out, const Syx2InsResult *banks, int nBanks);
+} Emitter;
+
+extern const Emitter emitters[NUM_FORMATS];
+
+/* Parse a comma separated list of format names into a mask. Returns 0 if a name
+isn't known. */
+int emitParseFormats(const char *list, unsigned *formats);
+
+/* Render banks in one format into a freshly allocated buffer of the right size.
+Returns 0 if memory runs out. Free the buffer with emitFree(). */
+int emitRender(OutputFormat format, const Syx2InsResult *banks, int nBanks, OutputBuffer *out);
+void emitFree(OutputBuffer *out);
+
+/* Write the whole buffer to a descriptor, one write() unless the kernel takes
+less. Returns 0 on failure. */
+int emitWrite(int fd, const OutputBuffer *out);
+
+/* Path of the file for format next to path: same name, the format's extension.
+malloc()ed. */
+char *emitPath(const char *path, OutputFormat format);
+
+#endif
@@ -0,0 +1,113 @@
+/********************************************************************************
+*	SYX2INS file helpers							*
+*									*
+*	See fileio.h.							*
+********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "fileio.h"
+
+static int copyInputs;
+
+void setCopyInputs(int copy)
+{
+    copyInputs = copy;
+}
+
+/* Read everything left on a descriptor that can't be mapped */
+static int readStream(int fd, InputFile *input)
+{
+    unsigned char *buffer = 0, *grown;
+    size_t size = 0, capacity = 0;
+    ssize_t got;
+
+    for (;;)
+    {
+        if (size == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 65536;
+            grown = realloc(buffer, capacity);
+            if (!grown)
+            {
+                free(buffer);
+                return 0;
+            }
+            buffer = grown;
+        }
+
+        got = read(fd, buffer + size, capacity - size);
+        if (got == 0)
+            break;
+        if (got < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            free(buffer);
+            return 0;
+        }
+        size += got;
+    }
+
+    input->data = buffer;
+    input->size = size;
+    input->mapped = 0;
+    return 1;
+}
+
+/* Open an input file for parsing. Returns 0 if it can't be opened or read. */
+int openInput(const char *path, InputFile *input)
+{
+    struct stat info;
+    void *view;
+    int fd, ok;
+
+    memset(input, 0, sizeof(*input));
+
+    if (!strcmp(path, "-"))
+        return readStream(STDIN_FILENO, input);
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    if (!copyInputs && fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+    {
+        if (info.st_size == 0)
+        {
+            close(fd);
+            return 1;
+        }
+
+        view = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view != MAP_FAILED)
+        {
+            /* The parser walks front to back, let the kernel read ahead while it works */
+            madvise(view, info.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            input->data = view;
+            input->size = info.st_size;
+            input->mapped = 1;
+            return 1;
+        }
+    }
+
+    ok = readStream(fd, input);
+    close(fd);
+    return ok;
+}
+
+void closeInput(InputFile *input)
+{
+    if (input->mapped > 0)
+        munmap((void *)input->data, input->size);
+    else if (!input->mapped)
+        free((void *)input->data);
+    memset(input, 0, sizeof(*input));
+}
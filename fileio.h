@@ -0,0 +1,26 @@
+/********************************************************************************
+*	SYX2INS file helpers							*
+*									*
+*	Reading dumps, shared by the command line tool and the benchmark.	*
+********************************************************************************/
+#ifndef SYX2INS_FILEIO_H
+#define SYX2INS_FILEIO_H
+
+/* A read-only view of one input file. Regular files are mapped straight into
+memory and parsed in place, pipes and stdin ("-") are read into a heap buffer. */
+typedef struct
+{
+    const unsigned char *data;
+    unsigned long size;
+    int mapped;                     //1 if data has to be munmap()ed, 0 if free()d, -1 if someone else owns it
+} InputFile;
+
+/* Open an input file for parsing. Returns 0 if it can't be opened or read. */
+int openInput(const char *path, InputFile *input);
+
+/* Never map inputs from now on, read them all into buffers. A mapped file cut
+short while it's parsed raises SIGBUS, batch and watch runs can't risk that. */
+void setCopyInputs(int copy);
+void closeInput(InputFile *input);
+
+#endif
@@ -0,0 +1,274 @@
+/********************************************************************************
+*	SYX2INS INS merging							*
+*									*
+*	See insmerge.h.							*
+********************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+
+#include "insmerge.h"
+#include "syx2ins.h"
+#include "cache.h"
+#include "fileio.h"
+
+#define NO_COMMENT      ((size_t)-1)
+
+static int isBlankLine(const char *p, const char *end)
+{
+    for (; p < end; p++)
+        if (*p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+            return 0;
+    return 1;
+}
+
+/* Length of a name once trailing spaces and the line end are cut off */
+static size_t trimmedLength(const char *name, const char *end)
+{
+    const char *p = end;
+
+    while (p > name && (p[-1] == ' ' || p[-1] == '\t' || p[-1] == '\r' || p[-1] == '\n'))
+        p--;
+    return p - name;
+}
+
+static int grow(void **items, int n, int *capacity, size_t itemSize)
+{
+    void *grown;
+
+    if (n < *capacity)
+        return 1;
+    grown = realloc(*items, (*capacity ? *capacity * 2 : 64) * itemSize);
+    if (!grown)
+        return 0;
+    *items = grown;
+    *capacity = *capacity ? *capacity * 2 : 64;
+    return 1;
+}
+
+int insIndexBuild(InsIndex *index, const char *text, size_t size)
+{
+    const char *line, *lineEnd, *close;
+    size_t pos = 0, commentStart = NO_COMMENT, contentEnd = 0;
+    int sectionCapacity = 0, entryCapacity = 0, inEntry = 0;
+    InsSection *section = 0;
+    InsEntry *entry;
+
+    memset(index, 0, sizeof(*index));
+    index->text = text;
+    index->size = size;
+
+    while (pos < size)
+    {
+        line = text + pos;
+        lineEnd = memchr(line, '\n', size - pos);
+        lineEnd = lineEnd ? lineEnd + 1 : text + size;
+
+        if (*line == '.' || *line == '[')
+        {
+            /* Whatever came last ends where its last real line does */
+            if (inEntry)
+                index->entries[index->nEntries - 1].end = contentEnd;
+            if (section)
+                section->bodyEnd = inEntry ? contentEnd : section->bodyEnd;
+            inEntry = 0;
+        }
+
+        if (*line == '.')
+        {
+            if (!grow((void **)&index->sections, index->nSections, &sectionCapacity, sizeof(*index->sections)))
+                return 0;
+            section = &index->sections[index->nSections++];
+            section->start = pos;
+            section->bodyEnd = lineEnd - text;
+            section->nameStart = pos;
+            section->nameLength = trimmedLength(line, lineEnd);
+            section->firstEntry = index->nEntries;
+            section->nEntries = 0;
+        }
+        else if (*line == '[' && section && (close = memchr(line, ']', lineEnd - line)) != 0)
+        {
+            if (!grow((void **)&index->entries, index->nEntries, &entryCapacity, sizeof(*index->entries)))
+                return 0;
+            entry = &index->entries[index->nEntries++];
+            entry->start = commentStart != NO_COMMENT ? commentStart : pos;
+            entry->nameStart = pos + 1;
+            entry->nameLength = close - line - 1;
+            entry->hash = syx2insHash(line + 1, entry->nameLength, SYX2INS_HASH_SEED);
+            section->nEntries++;
+            inEntry = 1;
+            contentEnd = lineEnd - text;
+        }
+        else if (*line == ';')
+        {
+            if (commentStart == NO_COMMENT)
+                commentStart = pos;
+            pos = lineEnd - text;
+            continue;
+        }
+        else if (!isBlankLine(line, lineEnd) && inEntry)
+            contentEnd = lineEnd - text;
+
+        commentStart = NO_COMMENT;
+        pos = lineEnd - text;
+    }
+
+    if (inEntry)
+        index->entries[index->nEntries - 1].end = contentEnd;
+    if (section && inEntry)
+        section->bodyEnd = contentEnd;
+    return 1;
+}
+
+void insIndexFree(InsIndex *index)
+{
+    free(index->sections);
+    free(index->entries);
+    memset(index, 0, sizeof(*index));
+}
+
+static const InsSection *findSection(const InsIndex *index, const char *name, size_t length)
+{
+    int s;
+
+    for (s = 0; s < index->nSections; s++)
+        if (index->sections[s].nameLength == length && !memcmp(index->text + index->sections[s].nameStart, name, length))
+            return &index->sections[s];
+    return 0;
+}
+
+static int findEntry(const InsIndex *index, const InsSection *section, const InsIndex *from, const InsEntry *wanted)
+{
+    const InsEntry *entry;
+    int e;
+
+    for (e = section->firstEntry; e < section->firstEntry + section->nEntries; e++)
+    {
+        entry = &index->entries[e];
+        if (entry->hash == wanted->hash && entry->nameLength == wanted->nameLength
+            && !memcmp(index->text + entry->nameStart, from->text + wanted->nameStart, wanted->nameLength))
+            return e;
+    }
+    return -1;
+}
+
+/* One change to the old text: [start, end) becomes the new text's [from, to),
+with a line break in front when it is added rather than replacing something.
+Edits at the same place stay in the order they were made. */
+typedef struct
+{
+    size_t start, end;
+    size_t from, to;
+    int added;
+    int order;
+} InsEdit;
+
+static int compareEdits(const void *a, const void *b)
+{
+    const InsEdit *ea = a, *eb = b;
+
+    if (ea->start != eb->start)
+        return ea->start < eb->start ? -1 : 1;
+    return ea->order - eb->order;
+}
+
+static int addEdit(InsEdit **edits, int *nEdits, int *capacity, size_t start, size_t end, size_t from, size_t to, int added)
+{
+    InsEdit *edit;
+
+    if (!grow((void **)edits, *nEdits, capacity, sizeof(**edits)))
+        return 0;
+    edit = &(*edits)[*nEdits];
+    edit->start = start;
+    edit->end = end;
+    edit->from = from;
+    edit->to = to;
+    edit->added = added;
+    edit->order = (*nEdits)++;
+    return 1;
+}
+
+/* Work out every edit add makes to old, then build the merged text in one buffer
+of the right size. Returns 0 if memory runs out. */
+static char *mergeText(const InsIndex *old, const InsIndex *add, size_t *mergedSize)
+{
+    const InsSection *section, *oldSection;
+    const InsEntry *entry;
+    InsEdit *edits = 0;
+    char *merged = 0, *out;
+    size_t copied = 0;
+    int nEdits = 0, capacity = 0, s, e, found, ok = 1;
+
+    for (s = 0; s < add->nSections && ok; s++)
+    {
+        section = &add->sections[s];
+        oldSection = findSection(old, add->text + section->nameStart, section->nameLength);
+
+        /* A section the file doesn't have yet goes on the end in one piece */
+        if (!oldSection)
+        {
+            ok = addEdit(&edits, &nEdits, &capacity, old->size, old->size, section->start, section->bodyEnd, 1);
+            continue;
+        }
+
+        for (e = section->firstEntry; e < section->firstEntry + section->nEntries && ok; e++)
+        {
+            entry = &add->entries[e];
+            found = findEntry(old, oldSection, add, entry);
+            if (found >= 0)
+                ok = addEdit(&edits, &nEdits, &capacity, old->entries[found].start, old->entries[found].end, entry->start, entry->end, 0);
+            else
+                ok = addEdit(&edits, &nEdits, &capacity, oldSection->bodyEnd, oldSection->bodyEnd, entry->start, entry->end, 1);
+        }
+    }
+    if (ok)
+    {
+        qsort(edits, nEdits, sizeof(*edits), compareEdits);
+
+        *mergedSize = old->size;
+        for (e = 0; e < nEdits; e++)
+            *mergedSize += edits[e].to - edits[e].from + edits[e].added - (edits[e].end - edits[e].start);
+        merged = malloc(*mergedSize ? *mergedSize : 1);
+    }
+    if (merged)
+    {
+        /* Everything between the edits is copied through untouched */
+        out = merged;
+        for (e = 0; e < nEdits; e++)
+        {
+            memcpy(out, old->text + copied, edits[e].start - copied);
+            out += edits[e].start - copied;
+            if (edits[e].added)
+                *out++ = '\n';
+            memcpy(out, add->text + edits[e].from, edits[e].to - edits[e].from);
+            out += edits[e].to - edits[e].from;
+            copied = edits[e].end;
+        }
+        memcpy(out, old->text + copied, old->size - copied);
+    }
+    free(edits);
+    return merged;
+}
+
+int insMergeFile(const char *path, const char *ins, size_t size)
+{
+    InsIndex old, add;
+    InputFile file;
+    char *merged = 0;
+    size_t mergedSize;
+    int ok = 0;
+
+    if (!openInput(path, &file))
+        return 0;
+
+    memset(&add, 0, sizeof(add));
+    if (insIndexBuild(&old, (const char *)file.data, file.size) && insIndexBuild(&add, ins, size))
+        merged = mergeText(&old, &add, &mergedSize);
+    if (merged)
+        ok = writeFileAtomic(path, merged, mergedSize);
+
+    free(merged);
+    insIndexFree(&add);
+    insIndexFree(&old);
+    closeInput(&file);
+    return ok;
+}
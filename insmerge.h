@@ -0,0 +1,56 @@
+/********************************************************************************
+*	SYX2INS INS merging							*
+*									*
+*	Lets many banks live in one master INS. The existing file is	*
+*	read once into an index of its sections (.Patch Names, .Note	*
+*	Names, .Instrument Definitions, and any others) and the [name]	*
+*	entries in each. Newly rendered INS text is indexed the same way,	*
+*	then every entry of it either replaces the entry of the same name	*
+*	in the same section or is added at the end of that section. All	*
+*	other bytes are copied through as they are, so comments, other	*
+*	instruments and hand edits survive.				*
+********************************************************************************/
+#ifndef SYX2INS_INSMERGE_H
+#define SYX2INS_INSMERGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* One [name] entry: comment lines right above it, the header line and every
+line up to the last one that isn't blank or a comment */
+typedef struct
+{
+    size_t start, end;
+    size_t nameStart, nameLength;   //Between the brackets
+    uint64_t hash;                  //Of the name
+} InsEntry;
+
+/* A .Section and its entries */
+typedef struct
+{
+    size_t start;                   //The .Section line
+    size_t bodyEnd;                 //End of its last entry, or of the .Section line without entries
+    size_t nameStart, nameLength;
+    int firstEntry, nEntries;
+} InsSection;
+
+typedef struct
+{
+    const char *text;
+    size_t size;
+    InsSection *sections;
+    int nSections;
+    InsEntry *entries;
+    int nEntries;
+} InsIndex;
+
+/* Index INS text held in memory, which has to stay around while the index is
+used. Returns 0 if memory runs out. */
+int insIndexBuild(InsIndex *index, const char *text, size_t size);
+void insIndexFree(InsIndex *index);
+
+/* Merge rendered INS text into the INS file at path and replace the file
+atomically. Returns 0 if it can't be read or written. */
+int insMergeFile(const char *path, const char *ins, size_t size);
+
+#endif
@@ -0,0 +1,764 @@
+/********************************************************************************
+*	SYX2INS conversion library						*
+*									*
+*	Framing, the MT-32 memory image and patch name resolution. See	*
+*	syx2ins.h for the interface.						*
+********************************************************************************/
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
+#include "syx2ins.h"
+
+#define NUM(a) (sizeof(a) / sizeof(*a))
+
+#define ROLAND_ID       0x41
+#define MT32_MODEL_ID   0x16
+#define ROLAND_DT1      0x12            //Roland "data set 1" command
+#define DT1_OVERHEAD    10              //F0 41 dev 16 12 a1 a2 a3 ... cs F7
+#define TIMBRE_SIZE     246             //Name, common parameters and four partials
+#define TIMBRE_PARTIAL_SIZE 58
+#define RHYTHM_KEYS     SYX2INS_RHYTHM_KEYS
+#define RHYTHM_OFF      127             //Rhythm setup timbre of a key that plays nothing
+
+/* One framed F0...F7 message. Pointers point back into the file buffer,
+nothing is copied. For Roland DT1 messages the header fields are decoded once
+here so the handlers below only have to look at the address and payload. */
+typedef struct
+{
+    const unsigned char *start;     //Position of the F0 byte
+    unsigned long length;           //Whole message including F0 and F7
+    unsigned char deviceId;
+    unsigned char modelId;
+    unsigned char command;
+    unsigned char address[3];
+    const unsigned char *data;      //Payload following the address bytes
+    unsigned long dataLength;       //Payload length without checksum and F7
+    int problem;                    //Syx2InsProblem, only the fields up to start and length are set otherwise
+} SysexMessage;
+
+#define MT32_ADDRESS(a, b, c)   SYX2INS_ADDRESS(a, b, c)
+
+/* ********************************************************************* */
+/* Preset tables and device profiles. Everything here is read-only data laid out
+by the compiler, nothing is built at startup. */
+
+/* Preset patch names, Group A (0-63) followed by Group B (64-127). The CM-32L
+and CM-64 have the same presets as the MT-32. */
+static const char presetPatches[128][11] =
+{
+    "AcouPiano1", "AcouPiano2", "AcouPiano3", "ElecPiano1", "ElecPiano2", "ElecPiano3",
+    "ElecPiano4", "Honkytonk", "Elec Org 1", "Elec Org 2", "Elec Org 3", "Elec Org 4",
+    "Pipe Org 1", "Pipe Org 2", "Pipe Org 3", "Accordion", "Harpsi 1", "Harpsi 2",
+    "Harpsi 3", "Clavi 1", "Clavi 2", "Clavi 3", "Celesta 1", "Celesta 2",
+    "Syn Brass1", "Syn Brass2", "Syn Brass3", "Syn Brass4", "Syn Bass 1", "Syn Bass 2",
+    "Syn Bass 3", "Syn Bass 4", "Fantasy", "Harmo Pan", "Chorale", "Glasses",
+    "Soundtrack", "Atmosphere", "Warm Bell", "Funny Vox", "Echo Bell", "Ice Rain",
+    "Oboe 2001", "Echo Pan", "DoctorSolo", "Schooldaze", "BellSinger", "SquareWave",
+    "Str Sect 1", "Str Sect 2", "Str Sect 3", "Pizzicato", "Violin 1", "Violin 2",
+    "Cello 1", "Cello 2", "Contrabass", "Harp 1", "Harp 2", "Guitar 1",
+    "Guitar 2", "Elec Gtr 1", "Elec Gtr 2", "Sitar", "Acou Bass1", "Acou Bass2",
+    "Elec Bass1", "Elec Bass2", "Slap Bass1", "Slap Bass2", "Fretless 1", "Fretless 2",
+    "Flute 1", "Flute 2", "Piccolo 1", "Piccolo 2", "Recorder", "Pan Pipes",
+    "Sax 1", "Sax 2", "Sax 3", "Sax 4", "Clarinet 1", "Clarinet 2",
+    "Oboe", "Engl Horn", "Bassoon", "Harmonica", "Trumpet 1", "Trumpet 2",
+    "Trombone 1", "Trombone 2", "Fr Horn 1", "Fr Horn 2", "Tuba", "Brs Sect 1",
+    "Brs Sect 2", "Vibe 1", "Vibe 2", "Syn Mallet", "Wind Bell", "Glock",
+    "Tube Bell", "Xylophone", "Marimba", "Koto", "Sho", "Shakuhachi",
+    "Whistle 1", "Whistle 2", "Bottleblow", "Breathpipe", "Timpani", "MelodicTom",
+    "Deep Snare", "Elec Perc1", "Elec Perc2", "Taiko", "Taiko Rim", "Cymbal",
+    "Castanets", "Triangle", "Orche Hit", "Telephone", "Bird Tweet", "OneNoteJam",
+    "WaterBells", "JungleTune"
+};
+
+/* Rhythm (PCM) timbres r01-r30 of the MT-32, followed by the sound effects
+r31-r63 the CM-32L and CM-64 add */
+static const char rhythmTimbres[63][11] =
+{
+    "Acou BD", "Acou SD", "Acou HiTom", "AcouMidTom", "AcouLowTom", "Elec SD",
+    "Clsd HiHat", "OpenHiHat1", "Crash Cym", "Ride Cym", "Rim Shot", "Hand Clap",
+    "Cowbell", "Mt HiConga", "High Conga", "Low Conga", "Hi Timbale", "LowTimbale",
+    "High Bongo", "Low Bongo", "High Agogo", "Low Agogo", "Tambourine", "Claves",
+    "Maracas", "SmbaWhis L", "SmbaWhis S", "Cabasa", "Quijada", "OpenHiHat2",
+    "Laughing", "Screaming", "Punch", "Heartbeat", "Footsteps1", "Footsteps2",
+    "Applause", "Creaking", "Door", "Scratch", "Windchime", "Engine",
+    "Car-stop", "Car-pass", "Crash", "Siren", "Train", "Jet",
+    "Helicopter", "Starship", "Pistol", "Machinegun", "Lasergun", "Explosion",
+    "Dog", "Horse", "Birds", "Rain", "Thunder", "Wind",
+    "Waves", "Stream", "Bubble"
+};
+
+/* Power-on timbre of rhythm keys 24-108, 64 + n for rhythm timbre r(n+1).
+The sound effect keys past 87 start out off here. */
+#define OFF RHYTHM_OFF
+static const unsigned char defaultRhythmSetup[RHYTHM_KEYS] =
+{
+    OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF,  64,   //Keys 24-35
+     64,  74,  65,  75,  69,  68,  70,  68,  93,  67,  71,  67,   //Keys 36-47
+     66,  72,  66,  73, OFF, OFF,  86, OFF,  76, OFF, OFF, OFF,   //Keys 48-59
+     82,  83,  77,  78,  79,  80,  81,  84,  85,  91,  88,  90,   //Keys 60-71
+     89,  92, OFF,  87, OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF,   //Keys 72-83
+    OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF,   //Keys 84-95
+    OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF,   //Keys 96-107
+    OFF                                                           //Key 108
+};
+#undef OFF
+
+const Syx2InsDevice syx2insDevices[SYX2INS_NUM_DEVICES] =
+{
+    { "MT-32", 64, 30, presetPatches, rhythmTimbres },
+    { "CM-32L", RHYTHM_KEYS, 63, presetPatches, rhythmTimbres },
+    { "CM-64", RHYTHM_KEYS, 63, presetPatches, rhythmTimbres }
+};
+
+/* ********************************************************************* */
+/* Byte scanners used by the framer. Captures from MIDI loggers can be megabytes of
+unrelated traffic with the odd MT-32 dump in between, so instead of checking every
+byte we look at 16 (SSE2) or 32 (AVX2) bytes per step. The version to use is
+picked once at startup from what the CPU supports, with a portable fallback.
+Looking for the end of a message also adds up its bytes on the way, which is all
+the Roland checksum needs, so checking it costs no second pass. */
+
+typedef struct
+{
+    /* Position of the next F0 41 xx 16 12 (MT-32 DT1) prefix at or after pos, fsize if none */
+    unsigned long (*findPrefix)(const unsigned char *buffer, unsigned long pos, unsigned long fsize);
+    /* Position of the next byte with the high bit set (any status byte), fsize if none.
+    The bytes before it are added to *sum. */
+    unsigned long (*findStatus)(const unsigned char *buffer, unsigned long pos, unsigned long fsize, unsigned long *sum);
+} SysexScanner;
+
+static int isPrefixAt(const unsigned char *p)
+{
+    return p[0] == 0xF0 && p[1] == ROLAND_ID && p[3] == MT32_MODEL_ID && p[4] == ROLAND_DT1;
+}
+
+static unsigned long findPrefixScalar(const unsigned char *buffer, unsigned long pos, unsigned long fsize)
+{
+    const unsigned char *f0;
+
+    while (pos + 5 <= fsize && (f0 = memchr(&buffer[pos], 0xF0, fsize - 4 - pos)) != 0)
+    {
+        pos = f0 - buffer;
+        if (isPrefixAt(f0))
+            return pos;
+        pos++;
+    }
+    return fsize;
+}
+
+static unsigned long findStatusScalar(const unsigned char *buffer, unsigned long pos, unsigned long fsize, unsigned long *sum)
+{
+    uint64_t word;
+
+    /* Eight bytes at a time, any set high bit means a status byte is in there.
+    Otherwise the bytes are added in pairs, then the four pair sums at once. */
+    for (; pos + 8 <= fsize; pos += 8)
+    {
+        memcpy(&word, &buffer[pos], 8);
+        if (word & 0x8080808080808080ULL)
+            break;
+        word = (word & 0x00FF00FF00FF00FFULL) + ((word >> 8) & 0x00FF00FF00FF00FFULL);
+        *sum += (unsigned long)((word * 0x0001000100010001ULL) >> 48);
+    }
+    for (; pos < fsize && buffer[pos] < 0x80; pos++)
+        *sum += buffer[pos];
+    return pos;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SCANNERS
+
+__attribute__((target("sse2")))
+static unsigned long findPrefixSSE2(const unsigned char *buffer, unsigned long pos, unsigned long fsize)
+{
+    const __m128i f0 = _mm_set1_epi8((char)0xF0), roland = _mm_set1_epi8(ROLAND_ID);
+    const __m128i model = _mm_set1_epi8(MT32_MODEL_ID), dt1 = _mm_set1_epi8(ROLAND_DT1);
+    unsigned int hits;
+
+    /* Lane i checks the prefix starting at pos+i, so each step reads up to pos+20 */
+    for (; pos + 20 <= fsize; pos += 16)
+    {
+        hits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&buffer[pos]), f0));
+        if (!hits)
+            continue;
+
+        hits &= _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&buffer[pos+1]), roland));
+        hits &= _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&buffer[pos+3]), model));
+        hits &= _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&buffer[pos+4]), dt1));
+        if (hits)
+            return pos + __builtin_ctz(hits);
+    }
+    return findPrefixScalar(buffer, pos, fsize);
+}
+
+/* Add the two 64 bit lanes psadbw leaves its sums in, in unsigned arithmetic */
+__attribute__((target("sse2")))
+static inline unsigned long addLanes64(__m128i sums)
+{
+    sums = _mm_add_epi64(sums, _mm_unpackhi_epi64(sums, sums));
+#ifdef __x86_64__
+    return (unsigned long)(uint64_t)_mm_cvtsi128_si64(sums);
+#else
+    return (unsigned long)(uint32_t)_mm_cvtsi128_si32(sums);
+#endif
+}
+
+__attribute__((target("sse2")))
+static unsigned long findStatusSSE2(const unsigned char *buffer, unsigned long pos, unsigned long fsize, unsigned long *sum)
+{
+    const __m128i lanes = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i bytes, sums = _mm_setzero_si128();
+    unsigned int hits = 0;
+
+    /* psadbw against 0 adds up each half of the 16 bytes. In the step that hits
+    a status byte only the lanes before it are added. */
+    for (; pos + 16 <= fsize; pos += 16)
+    {
+        bytes = _mm_loadu_si128((const __m128i *)&buffer[pos]);
+        hits = _mm_movemask_epi8(bytes);
+        if (hits)
+            bytes = _mm_and_si128(bytes, _mm_cmplt_epi8(lanes, _mm_set1_epi8((char)__builtin_ctz(hits))));
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(bytes, _mm_setzero_si128()));
+        if (hits)
+            break;
+    }
+    *sum += addLanes64(sums);
+    return hits ? pos + __builtin_ctz(hits) : findStatusScalar(buffer, pos, fsize, sum);
+}
+
+__attribute__((target("avx2")))
+static unsigned long findPrefixAVX2(const unsigned char *buffer, unsigned long pos, unsigned long fsize)
+{
+    const __m256i f0 = _mm256_set1_epi8((char)0xF0), roland = _mm256_set1_epi8(ROLAND_ID);
+    const __m256i model = _mm256_set1_epi8(MT32_MODEL_ID), dt1 = _mm256_set1_epi8(ROLAND_DT1);
+    unsigned int hits;
+
+    for (; pos + 36 <= fsize; pos += 32)
+    {
+        hits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&buffer[pos]), f0));
+        if (!hits)
+            continue;
+
+        hits &= _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&buffer[pos+1]), roland));
+        hits &= _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&buffer[pos+3]), model));
+        hits &= _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&buffer[pos+4]), dt1));
+        if (hits)
+            return pos + __builtin_ctz(hits);
+    }
+    return findPrefixSSE2(buffer, pos, fsize);
+}
+
+__attribute__((target("avx2")))
+static unsigned long findStatusAVX2(const unsigned char *buffer, unsigned long pos, unsigned long fsize, unsigned long *sum)
+{
+    const __m256i lanes = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+        16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+    __m256i bytes, sums = _mm256_setzero_si256();
+    __m128i half;
+    unsigned int hits = 0;
+
+    for (; pos + 32 <= fsize; pos += 32)
+    {
+        bytes = _mm256_loadu_si256((const __m256i *)&buffer[pos]);
+        hits = _mm256_movemask_epi8(bytes);
+        if (hits)
+            bytes = _mm256_and_si256(bytes, _mm256_cmpgt_epi8(_mm256_set1_epi8((char)__builtin_ctz(hits)), lanes));
+        sums = _mm256_add_epi64(sums, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+        if (hits)
+            break;
+    }
+    half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+    *sum += addLanes64(half);
+    if (hits)
+        return pos + __builtin_ctz(hits);
+    /* Less than a vector left. Leave AVX state clean before going to SSE2 code. */
+    _mm256_zeroupper();
+    return findStatusScalar(buffer, pos, fsize, sum);
+}
+#endif
+
+static SysexScanner scanner = { findPrefixScalar, findStatusScalar };
+
+/* Pick the widest scanner this CPU can run. Call once before any parsing starts. */
+static const char *initScanner(void)
+{
+#ifdef HAVE_X86_SCANNERS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        scanner.findPrefix = findPrefixAVX2;
+        scanner.findStatus = findStatusAVX2;
+        return "AVX2";
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        scanner.findPrefix = findPrefixSSE2;
+        scanner.findStatus = findStatusSSE2;
+        return "SSE2";
+    }
+#endif
+    return "scalar";
+}
+
+/* Find the next MT-32 DT1 message at or after *pos. Anything that isn't one
+(other manufacturers, channel messages in captures) is skipped by the scanner
+without being framed. A status byte other than F7 inside a message, or the end of
+the buffer, means it was cut short, so it comes back as SYX2INS_TRUNCATED and
+framing resyncs on that byte instead of trusting fixed offsets. The address,
+payload and checksum bytes of an intact message add up to a multiple of 128;
+only the low 7 bits of the sum matter, so it may wrap. Returns 0 when the buffer
+is exhausted. */
+static int nextSysexMessage(const unsigned char *buffer, unsigned long fsize, unsigned long *pos, SysexMessage *msg)
+{
+    unsigned long ii = *pos, end, sum = 0;
+
+    if ((ii = scanner.findPrefix(buffer, ii, fsize)) >= fsize)
+    {
+        *pos = fsize;
+        return 0;
+    }
+    end = scanner.findStatus(buffer, ii + 1, fsize, &sum);
+
+    msg->start = &buffer[ii];
+    if (end >= fsize || buffer[end] != 0xF7 || end + 1 - ii < DT1_OVERHEAD)
+    {
+        msg->length = end - ii;
+        msg->problem = SYX2INS_TRUNCATED;
+        if (msg->length >= 8)
+            memcpy(msg->address, &buffer[ii+5], 3);
+        else
+            memset(msg->address, 0, 3);
+        *pos = end;
+        return 1;
+    }
+
+    msg->length = end - ii + 1;
+    msg->deviceId = buffer[ii+2];
+    msg->modelId = buffer[ii+3];
+    msg->command = buffer[ii+4];
+    memcpy(msg->address, &buffer[ii+5], 3);
+    msg->data = &buffer[ii+8];
+    msg->dataLength = msg->length - DT1_OVERHEAD;
+    sum -= ROLAND_ID + msg->deviceId + MT32_MODEL_ID + ROLAND_DT1;
+    msg->problem = sum & 0x7F ? SYX2INS_BAD_CHECKSUM : SYX2INS_MESSAGE_OK;
+    *pos = end + 1;
+    return 1;
+}
+
+/* MT-32 'write to display' (20 00 00): the first one names the patch list */
+static void handleDisplay(Syx2InsState *state, const unsigned char *data, unsigned long length)
+{
+    unsigned long i;
+
+    if (state->haveDisplay)
+        return;
+
+    memset(state->display, 0, sizeof(state->display));
+    for (i = 0; i < sizeof(state->display) && i < length; i++)
+        state->display[i] = data[i];
+    state->haveDisplay = 1;
+}
+
+/* Where each area of MT32Memory sits in the MT-32 address space */
+typedef struct
+{
+    unsigned long address;
+    unsigned long size;
+    size_t offset;                  //Offset of the area inside MT32Memory
+    size_t writtenOffset;           //Offset of its written flags
+    unsigned long entrySize;        //Bytes covered by one written flag
+} MemoryArea;
+
+static const MemoryArea memoryAreas[] =
+{
+    { MT32_ADDRESS(0x03, 0x01, 0x10), RHYTHM_KEYS * 4, offsetof(MT32Memory, rhythmSetup), offsetof(MT32Memory, rhythmWritten), 4 },
+    { MT32_ADDRESS(0x05, 0x00, 0x00), 128 * 8, offsetof(MT32Memory, patchMemory), offsetof(MT32Memory, patchWritten), 8 },
+    { MT32_ADDRESS(0x08, 0x00, 0x00), 64 * 256, offsetof(MT32Memory, timbreMemory), offsetof(MT32Memory, timbreWritten), 256 },
+    { MT32_ADDRESS(0x10, 0x00, 0x00), 23, offsetof(MT32Memory, systemArea), offsetof(MT32Memory, systemWritten), 23 }
+};
+
+/* Power-on state: patch n plays timbre n of Group A (0-63) or Group B (64-127),
+rhythm keys play their default drums at full level, centered, with reverb */
+static void resetMT32Memory(MT32Memory *memory)
+{
+    static const unsigned char defaultPatch[8] = { 0, 0, 24, 50, 12, 0, 1, 0 };
+    int i;
+
+    memset(memory, 0, sizeof(*memory));
+    for (i = 0; i < 128; i++)
+    {
+        memcpy(memory->patchMemory[i], defaultPatch, 8);
+        memory->patchMemory[i][0] = i / 64;
+        memory->patchMemory[i][1] = i % 64;
+    }
+    for (i = 0; i < RHYTHM_KEYS; i++)
+    {
+        memory->rhythmSetup[i][0] = defaultRhythmSetup[i];
+        memory->rhythmSetup[i][1] = 100;
+        memory->rhythmSetup[i][2] = 7;
+        memory->rhythmSetup[i][3] = 1;
+    }
+}
+
+/* Apply one DT1 write. Only the part of the payload that lands inside a known
+area is copied, anything outside of them is ignored. Returns nonzero if the write
+starts inside an area but runs past its end. */
+static int applyDT1(MT32Memory *memory, unsigned long address, const unsigned char *data, unsigned long length)
+{
+    unsigned long a, from, to;
+    const MemoryArea *area;
+    int overrun = 0;
+
+    for (a = 0; a < NUM(memoryAreas); a++)
+    {
+        area = &memoryAreas[a];
+        from = address > area->address ? address : area->address;
+        to = address + length < area->address + area->size ? address + length : area->address + area->size;
+        if (from >= to)
+            continue;
+        if (address >= area->address && address + length > area->address + area->size)
+            overrun = 1;
+
+        memcpy((unsigned char *)memory + area->offset + (from - area->address), &data[from - address], to - from);
+        memset((unsigned char *)memory + area->writtenOffset + (from - area->address) / area->entrySize, 1,
+            (to - 1 - area->address) / area->entrySize - (from - area->address) / area->entrySize + 1);
+    }
+    return overrun;
+}
+
+const char *syx2insInit(void)
+{
+    return initScanner();
+}
+
+/* A dump is only accepted when it starts with a Roland MT-32 DT1 message */
+int syx2insIsMT32(const unsigned char *data, size_t size)
+{
+    static const unsigned char sysexPattern[5] = { 0xF0, 0x41, 0x10, 0x16, 0x12 };     //This is an array of the MT-32 Sysex send code bytes
+
+    return size >= NUM(sysexPattern) && !memcmp(data, sysexPattern, NUM(sysexPattern));
+}
+
+void syx2insReset(Syx2InsState *state)
+{
+    memset(state, 0, sizeof(*state));
+    resetMT32Memory(&state->memory);
+}
+
+/* The display isn't memory, it only names the bank. The CM-32P part of a CM-64
+only tells us which unit the dump is for. Everything else is written into the
+emulated memory image. Returns nonzero if the write ran past the end of an area. */
+static int writeState(Syx2InsState *state, unsigned long address, const unsigned char *data, size_t size)
+{
+    state->nMessages++;
+
+    if (address >> 14 == 0x20)
+        handleDisplay(state, data, size);
+    else if (address >> 14 >= 0x50 && address >> 14 <= 0x52)
+        state->wroteCM32P = 1;
+    else
+        return applyDT1(&state->memory, address, data, size);
+    return 0;
+}
+
+void syx2insWrite(Syx2InsState *state, unsigned long address, const unsigned char *data, size_t size)
+{
+    writeState(state, address, data, size);
+}
+
+static void addDiagnostic(Syx2InsDiagnostics *diagnostics, size_t offset, const SysexMessage *msg, int problem)
+{
+    Syx2InsDiagnostic *diagnostic;
+
+    if (diagnostics->total < SYX2INS_MAX_DIAGNOSTICS)
+    {
+        diagnostic = &diagnostics->first[diagnostics->total];
+        diagnostic->offset = offset;
+        diagnostic->length = msg->length;
+        diagnostic->address = MT32_ADDRESS(msg->address[0], msg->address[1], msg->address[2]);
+        diagnostic->problem = problem;
+    }
+    diagnostics->counts[problem]++;
+    diagnostics->total++;
+}
+
+/* Hand one MT-32 DT1 payload to the display handler or the memory image depending
+on its address. A damaged message is only recorded. */
+static void applyMessage(Syx2InsState *state, size_t offset, const SysexMessage *msg)
+{
+    if (msg->problem != SYX2INS_MESSAGE_OK)
+        addDiagnostic(&state->diagnostics, offset, msg, msg->problem);
+    else if (writeState(state, MT32_ADDRESS(msg->address[0], msg->address[1], msg->address[2]), msg->data, msg->dataLength))
+        addDiagnostic(&state->diagnostics, offset, msg, SYX2INS_OUT_OF_RANGE);
+}
+
+/* Walk the buffer exactly once, checking and applying every message as it is framed */
+void syx2insParse(Syx2InsState *state, const unsigned char *data, size_t size)
+{
+    SysexMessage msg;
+    unsigned long pos = 0;
+
+    while (nextSysexMessage(data, size, &pos, &msg))
+        applyMessage(state, msg.start - data, &msg);
+}
+
+size_t syx2insFrameRange(const unsigned char *data, size_t size, size_t from, size_t to, Syx2InsMessage *messages, size_t max, size_t *next)
+{
+    SysexMessage msg;
+    unsigned long pos = from;
+    size_t n = 0;
+
+    while (n < max && pos < to && nextSysexMessage(data, size, &pos, &msg))
+    {
+        if ((size_t)(msg.start - data) >= to)
+        {
+            pos = to;
+            break;
+        }
+        messages[n].offset = msg.start - data;
+        messages[n].length = msg.length;
+        messages[n].address = MT32_ADDRESS(msg.address[0], msg.address[1], msg.address[2]);
+        messages[n].problem = msg.problem;
+        n++;
+    }
+
+    *next = pos < to ? pos : to;
+    return n;
+}
+
+void syx2insApplyMessages(Syx2InsState *state, const unsigned char *data, const Syx2InsMessage *messages, size_t n)
+{
+    SysexMessage msg;
+    const unsigned char *p;
+    size_t i;
+
+    /* The messages were framed and checked already, only the header fields need
+    decoding again */
+    for (i = 0; i < n; i++)
+    {
+        p = data + messages[i].offset;
+        msg.start = p;
+        msg.length = messages[i].length;
+        msg.problem = messages[i].problem;
+        msg.address[0] = (messages[i].address >> 14) & 0x7F;
+        msg.address[1] = (messages[i].address >> 7) & 0x7F;
+        msg.address[2] = messages[i].address & 0x7F;
+        if (msg.problem != SYX2INS_TRUNCATED)
+        {
+            msg.deviceId = p[2];
+            msg.modelId = p[3];
+            msg.command = p[4];
+            msg.data = &p[8];
+            msg.dataLength = msg.length - DT1_OVERHEAD;
+        }
+        applyMessage(state, messages[i].offset, &msg);
+    }
+}
+
+unsigned long syx2insCountMessages(const unsigned char *data, size_t size)
+{
+    SysexMessage msg;
+    unsigned long pos = 0, n = 0;
+
+    while (nextSysexMessage(data, size, &pos, &msg))
+        n += msg.problem == SYX2INS_MESSAGE_OK;
+    return n;
+}
+
+/* Which unit a dump was made for. A CM-32P part makes it a CM-64, rhythm keys
+or sound effects only the CM-32L has make it a CM-32L. The MT-32 uses rhythm
+timbre 94 (r31 on a CM-32L) to switch a key off, so that one doesn't count. */
+static int detectDevice(const Syx2InsState *state)
+{
+    const MT32Memory *memory = &state->memory;
+    int i;
+
+    if (state->wroteCM32P)
+        return SYX2INS_CM64;
+    for (i = 0; i < RHYTHM_KEYS; i++)
+    {
+        if (!memory->rhythmWritten[i])
+            continue;
+        if (i >= syx2insDevices[SYX2INS_MT32].nRhythmKeys)
+            return SYX2INS_CM32L;
+        if (memory->rhythmSetup[i][0] > 64 + 30 && memory->rhythmSetup[i][0] < RHYTHM_OFF)
+            return SYX2INS_CM32L;
+    }
+    return SYX2INS_MT32;
+}
+
+/* Copy a 10 character name out of the memory image */
+static void copyName(char name[11], const unsigned char *source)
+{
+    memcpy(name, source, 10);
+    name[10] = 0;
+}
+
+/* Highest value of each timbre parameter after the name: the common block, then
+one partial (WG, pitch envelope and LFO, TVF, TVA). The four partials share the
+table. */
+static const unsigned char commonRange[4] = { 12, 12, 15, 1 };
+static const unsigned char partialRange[TIMBRE_PARTIAL_SIZE] =
+{
+    96, 100, 16, 1, 3, 127, 100, 14,                    //WG
+    10, 3, 4, 100, 100, 100, 100, 100, 100, 100, 100, 100,  //Pitch envelope
+    100, 100, 100,                                      //Pitch LFO
+    100, 30, 16, 127, 14, 100, 100, 4, 4,               //TVF
+    100, 100, 100, 100, 100, 100, 100, 100, 100,        //TVF envelope
+    100, 100, 127, 12, 127, 12, 4, 4,                   //TVA
+    100, 100, 100, 100, 100, 100, 100, 100, 100         //TVA envelope
+};
+
+static unsigned char scaleParameter(unsigned char value, unsigned char range)
+{
+    return value >= range ? 255 : (unsigned char)((value * 255 + range / 2) / range);
+}
+
+/* Every parameter scaled to 0-255 so they all weigh the same in a distance, with
+the partials the timbre mutes left at 0 since they don't sound */
+static void timbreFeatures(unsigned char features[SYX2INS_TIMBRE_FEATURES], const unsigned char *timbre)
+{
+    const unsigned char *partial;
+    int i, p;
+
+    for (i = 0; i < 4; i++)
+        features[i] = scaleParameter(timbre[10 + i], commonRange[i]);
+    for (p = 0; p < 4; p++)
+    {
+        partial = &timbre[14 + p * TIMBRE_PARTIAL_SIZE];
+        for (i = 0; i < TIMBRE_PARTIAL_SIZE; i++)
+            features[4 + p * TIMBRE_PARTIAL_SIZE + i] = timbre[12] & (1 << p) ? scaleParameter(partial[i], partialRange[i]) : 0;
+    }
+}
+
+/* Resolve the memory image into the final list of 128 patch names. Patch list
+names come from three sources (or groups of timbres):
+Default Preset Group A 0-63
+Default Preset Group B 64-127
+Custom Timbre Group 0-63
+Custom timbre names are read straight from the timbre memory image. */
+void syx2insResolve(const Syx2InsState *state, Syx2InsResult *result)
+{
+    const MT32Memory *memory = &state->memory;
+    const Syx2InsDevice *device;
+    const char (*presets)[11];
+    static const char off[11];
+    const char *rhythmIndex[128];
+    uint64_t sound;
+    int i;
+
+    /* We don't want preceding empty spaces in front of the display text
+    so we remove them for the title */
+    memset(result->title, 0, sizeof(result->title));
+    result->haveTitle = state->haveDisplay;
+    if (state->haveDisplay)
+    {
+        for (i = 0; i < 20 && state->display[i] == 0x20; i++)
+            ;
+        memcpy(result->title, &state->display[i], 20 - i);
+    }
+
+    for (i = 0; i < 64; i++)
+    {
+        copyName(result->timbreNames[i], memory->timbreMemory[i]);
+        result->timbreHash[i] = syx2insHash(&memory->timbreMemory[i][10], TIMBRE_SIZE - 10, SYX2INS_HASH_SEED);
+        timbreFeatures(result->timbreFeatures[i], memory->timbreMemory[i]);
+    }
+    memcpy(result->timbreWritten, memory->timbreWritten, sizeof(result->timbreWritten));
+    result->diagnostics = state->diagnostics;
+
+    result->device = detectDevice(state);
+    device = &syx2insDevices[result->device];
+    presets = device->patchNames;
+
+    result->soundHash = SYX2INS_HASH_SEED;
+    for(i = 0; i < 128; i++)
+    {
+        const unsigned char *entry = memory->patchMemory[i];
+        const char *name;
+
+        /* Patches that don't point anywhere sensible (rhythm, or an all zero
+        record) keep the stock name for their slot, like the default MT-32
+        patch listing */
+        name = presets[i];
+
+        /* These conditional statements determine whether the instrument is from Preset Group A,
+        Preset Group B, or the Custom Timbre memory group */
+        if (entry[0] == 0x00 && entry[2] != 0x00 && entry[1] < 64)
+            name = presets[ entry[1] ];
+        else if(entry[0] == 0x01 && entry[1] < 64)
+            name = presets[ entry[1] + 64 ];
+        else if(entry[0] == 0x02 && entry[1] < 64)
+            name = result->timbreNames[ entry[1] ];
+
+        /* Every name is a fixed 11 byte slot, so this is one copy of known size */
+        memcpy(result->patchNames[i], name, 11);
+
+        /* Presets go into the sound hash by number, custom timbres by their parameters */
+        sound = entry[0] == 0x02 && entry[1] < 64 ? result->timbreHash[ entry[1] ] : (uint64_t)entry[0] << 8 | entry[1];
+        result->soundHash = syx2insHash(&sound, sizeof(sound), result->soundHash);
+    }
+    memcpy(result->patchWritten, memory->patchWritten, sizeof(result->patchWritten));
+
+    memcpy(result->rhythmSetup, memory->rhythmSetup, sizeof(result->rhythmSetup));
+    memcpy(result->rhythmWritten, memory->rhythmWritten, sizeof(result->rhythmWritten));
+
+    /* A rhythm key plays custom timbre 0-63 or rhythm timbre 64 on, anything past
+    the device's last rhythm timbre is off. Index every timbre number once, then
+    naming a key is a single lookup. */
+    for (i = 0; i < 128; i++)
+        rhythmIndex[i] = i < 64 ? result->timbreNames[i] : i - 64 < device->nRhythmTimbres ? device->rhythmTimbreNames[i - 64] : off;
+    memset(result->rhythmNames, 0, sizeof(result->rhythmNames));
+    for (i = 0; i < device->nRhythmKeys; i++)
+        memcpy(result->rhythmNames[i], rhythmIndex[memory->rhythmSetup[i][0] & 0x7F], 11);
+}
+
+int syx2insConvert(const unsigned char *data, size_t size, Syx2InsState *state, Syx2InsResult *result)
+{
+    if (!syx2insIsMT32(data, size))
+        return SYX2INS_NOT_MT32;
+
+    syx2insReset(state);
+    syx2insParse(state, data, size);
+    syx2insResolve(state, result);
+    return SYX2INS_OK;
+}
+
+uint64_t syx2insHash(const void *data, size_t size, uint64_t seed)
+{
+    const unsigned char *p = data;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        seed ^= p[i];
+        seed *= 0x100000001B3ULL;
+    }
+    return seed;
+}
+
+/* Generate the list title from the SYX filename when the dump has no display text.
+Directories and the extension are left out and the result is cut to 20 characters. */
+void syx2insTitleFromPath(const char *path, char title[21])
+{
+    const char *base = path, *dot, *p;
+    size_t len;
+
+    for (p = path; *p; p++)
+        if (*p == '/' || *p == '\\' || *p == ':')
+            base = p + 1;
+
+    /* Get position of the last dot in the SYX filename */
+    dot = strrchr(base, '.');
+    /* If a dot was found, calculate the length to this point */
+    len = dot ? (size_t)(dot - base) : strlen(base);
+    if (len > 20)
+        len = 20;
+
+    memcpy(title, base, len);
+    title[len] = 0;
+}
@@ -0,0 +1,177 @@
+/********************************************************************************
+*	SYX2INS logging and metrics						*
+*									*
+*	See logging.h.							*
+********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "logging.h"
+
+int logSinkOpen(LogSink *sink, const char *path, LogLevel level)
+{
+    memset(sink, 0, sizeof(*sink));
+    pthread_mutex_init(&sink->lock, 0);
+    sink->level = level;
+
+    if (level == LOG_OFF || !path)
+        return 1;
+
+    if (!strcmp(path, "-"))
+        sink->file = stdout;
+    else
+    {
+        sink->file = fopen(path, "w");
+        sink->ownFile = 1;
+    }
+    return sink->file != 0;
+}
+
+void logSinkClose(LogSink *sink)
+{
+    if (sink->file && sink->ownFile)
+        fclose(sink->file);
+    else if (sink->file)
+        fflush(sink->file);
+    pthread_mutex_destroy(&sink->lock);
+    memset(sink, 0, sizeof(*sink));
+}
+
+void logSinkFlush(LogSink *sink)
+{
+    if (sink->file)
+    {
+        pthread_mutex_lock(&sink->lock);
+        fflush(sink->file);
+        pthread_mutex_unlock(&sink->lock);
+    }
+}
+
+int logParseLevel(const char *name, LogLevel *level)
+{
+    static const char *names[] = { "off", "summary", "trace" };
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        if (!strcmp(name, names[i]))
+        {
+            *level = (LogLevel)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void loggerBegin(Logger *logger, LogSink *sink)
+{
+    memset(logger, 0, sizeof(*logger));
+    logger->sink = sink && sink->file ? sink : 0;
+}
+
+void logPrint(Logger *logger, LogLevel level, const char *format, ...)
+{
+    va_list args;
+    int length;
+
+    if (!logEnabled(logger, level))
+        return;
+
+    va_start(args, format);
+    length = vsnprintf(0, 0, format, args);
+    va_end(args);
+    if (length < 0)
+        return;
+
+    if (logger->size + length + 1 > logger->capacity)
+    {
+        size_t capacity = logger->capacity ? logger->capacity : 4096;
+        char *grown;
+
+        while (logger->size + length + 1 > capacity)
+            capacity *= 2;
+        grown = realloc(logger->text, capacity);
+        if (!grown)
+            return;
+        logger->text = grown;
+        logger->capacity = capacity;
+    }
+
+    va_start(args, format);
+    vsnprintf(logger->text + logger->size, length + 1, format, args);
+    va_end(args);
+    logger->size += length;
+}
+
+void loggerEnd(Logger *logger)
+{
+    if (logger->sink && logger->size)
+    {
+        pthread_mutex_lock(&logger->sink->lock);
+        fwrite(logger->text, 1, logger->size, logger->sink->file);
+        pthread_mutex_unlock(&logger->sink->lock);
+    }
+    free(logger->text);
+    memset(logger, 0, sizeof(*logger));
+}
+
+double metricsNow(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+void metricsAdd(ConversionMetrics *total, const ConversionMetrics *metrics)
+{
+    total->files += metrics->files;
+    total->failed += metrics->failed;
+    total->fromCache += metrics->fromCache;
+    total->bytesScanned += metrics->bytesScanned;
+    total->messagesFramed += metrics->messagesFramed;
+    total->damagedMessages += metrics->damagedMessages;
+    total->timbresResolved += metrics->timbresResolved;
+    total->patchesResolved += metrics->patchesResolved;
+    total->loadSeconds += metrics->loadSeconds;
+    total->parseSeconds += metrics->parseSeconds;
+    total->resolveSeconds += metrics->resolveSeconds;
+    total->emitSeconds += metrics->emitSeconds;
+}
+
+int metricsWriteJson(const char *path, const ConversionMetrics *metrics, double wallSeconds)
+{
+    FILE *file = strcmp(path, "-") ? fopen(path, "w") : stdout;
+    int ok;
+
+    if (!file)
+        return 0;
+
+    /* Phase times are added up over all conversions, with several threads they
+    can be more than the wall time */
+    fprintf(file, "{\n");
+    fprintf(file, "  \"files\": %lu,\n", metrics->files);
+    fprintf(file, "  \"failed\": %lu,\n", metrics->failed);
+    fprintf(file, "  \"fromCache\": %lu,\n", metrics->fromCache);
+    fprintf(file, "  \"bytesScanned\": %llu,\n", metrics->bytesScanned);
+    fprintf(file, "  \"messagesFramed\": %llu,\n", metrics->messagesFramed);
+    fprintf(file, "  \"damagedMessages\": %lu,\n", metrics->damagedMessages);
+    fprintf(file, "  \"timbresResolved\": %lu,\n", metrics->timbresResolved);
+    fprintf(file, "  \"patchesResolved\": %lu,\n", metrics->patchesResolved);
+    fprintf(file, "  \"seconds\": {\n");
+    fprintf(file, "    \"load\": %.6f,\n", metrics->loadSeconds);
+    fprintf(file, "    \"parse\": %.6f,\n", metrics->parseSeconds);
+    fprintf(file, "    \"resolve\": %.6f,\n", metrics->resolveSeconds);
+    fprintf(file, "    \"emit\": %.6f,\n", metrics->emitSeconds);
+    fprintf(file, "    \"wall\": %.6f\n", wallSeconds);
+    fprintf(file, "  }\n");
+    fprintf(file, "}\n");
+
+    ok = !ferror(file);
+    if (file == stdout)
+        return fflush(file) == 0 && ok;
+    return fclose(file) == 0 && ok;
+}
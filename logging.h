@@ -0,0 +1,94 @@
+/********************************************************************************
+*	SYX2INS logging and metrics						*
+*									*
+*	Log text is collected per conversion in a memory buffer and handed	*
+*	to the sink in one write when the conversion is done, so nothing	*
+*	is written while parsing and parallel conversions don't interleave	*
+*	their lines. A disabled sink costs one comparison per message.	*
+*	Metrics are plain counters and phase times that each conversion	*
+*	fills in and the caller adds up and exports as JSON.		*
+********************************************************************************/
+#ifndef SYX2INS_LOGGING_H
+#define SYX2INS_LOGGING_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+typedef enum
+{
+    LOG_OFF,
+    LOG_SUMMARY,                    //One line per file, errors
+    LOG_TRACE                       //Every step and every patch name, what log.txt always had
+} LogLevel;
+
+/* Where log text goes. Shared by all conversions of a run. */
+typedef struct
+{
+    FILE *file;                     //NULL when logging is off
+    int ownFile;                    //We opened it and have to close it
+    LogLevel level;
+    pthread_mutex_t lock;
+} LogSink;
+
+/* Open a sink at path ("-" for stdout). Level LOG_OFF or a NULL path gives a
+disabled sink. Returns 0 if the file can't be created. */
+int logSinkOpen(LogSink *sink, const char *path, LogLevel level);
+void logSinkClose(LogSink *sink);
+
+/* Push out what the sink's stdio buffer holds, for long running modes */
+void logSinkFlush(LogSink *sink);
+
+/* Parse "off", "summary" or "trace". Returns 0 for anything else. */
+int logParseLevel(const char *name, LogLevel *level);
+
+/* Log text of one conversion */
+typedef struct
+{
+    LogSink *sink;
+    char *text;
+    size_t size, capacity;
+} Logger;
+
+void loggerBegin(Logger *logger, LogSink *sink);
+
+/* Nonzero if a message of this level would be kept. Check it before doing any
+work just to build a message. */
+static inline int logEnabled(const Logger *logger, LogLevel level)
+{
+    return logger->sink && level != LOG_OFF && level <= logger->sink->level;
+}
+
+#if defined(__GNUC__)
+__attribute__((format(printf, 3, 4)))
+#endif
+void logPrint(Logger *logger, LogLevel level, const char *format, ...);
+
+/* Hand everything collected to the sink in one write and free the buffer */
+void loggerEnd(Logger *logger);
+
+/* Counters and phase times of one or more conversions */
+typedef struct
+{
+    unsigned long files;
+    unsigned long failed;
+    unsigned long fromCache;
+    unsigned long long bytesScanned;
+    unsigned long long messagesFramed;
+    unsigned long damagedMessages;  //Failed their checksum or length checks
+    unsigned long timbresResolved;  //Custom timbres the dumps wrote
+    unsigned long patchesResolved;  //Patches the dumps wrote
+    double loadSeconds;
+    double parseSeconds;
+    double resolveSeconds;
+    double emitSeconds;
+} ConversionMetrics;
+
+/* Monotonic clock in seconds for phase times */
+double metricsNow(void);
+
+void metricsAdd(ConversionMetrics *total, const ConversionMetrics *metrics);
+
+/* Write the metrics as one JSON object. Returns 0 on failure. */
+int metricsWriteJson(const char *path, const ConversionMetrics *metrics, double wallSeconds);
+
+#endif
@@ -1,509 +1,1796 @@
-/********************************************************************************
-*	SYX2INS conversion utility   v1.00		    	    		*
-*	by Brandon Blume					    		*
-*	July 11, 2015						    		*
-*								    		*
-*	Command line tool to pull/generate the instrument patch list		*
-*	from a custom MT-32 programmed SYX dump file into 	    		*
-*	Cakewalk/Sonar's INS format (MIDI instrument list).	    		*
-*								    		*
-*	You're free to do with it as you please. This program could 		*
-*	probably be vastly improved to be more efficient, but it works.		*
-*	It's also missing error handling for a couple instances where		*
-*	MIDI command data might not exist partway through the SYX file.		*
-********************************************************************************/
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-#define NUM(a) (sizeof(a) / sizeof(*a))
-
-int main (int argc, char *argv[])
-{
-	float nVersion = 1.00;
-
-    unsigned char sysexPattern[5] = { 0xF0, 0x41, 0x10, 0x16, 0x12 };       //This is an array of the MT-32 Sysex send code bytes
-    unsigned char timbreSet[6] = { 0xF0, 0x41, 0x10, 0x16, 0x12, 0x08 };    //Beginning of MT-32 Sysex set custom Timbre bytes (08 xx xx)
-    unsigned char patchSet[6] = { 0xF0, 0x41, 0x10, 0x16, 0x12, 0x05 };    //Beginning of MT-32 Sysex set Patch bytes (05 xx xx)
-    char stockPatches[128][11];
-    char customTimbres[64][11];
-    char newPatches[128][11];
-
-    char gameTitle[21];             //Make array 1 element larger than the contents to make room for NULL character
-    gameTitle[20] = '\0';           //Terminate end of string with a NULL character to avoid garbage characters when printing string later
-    char *dot, *syxFilename;        //Pointers for handling existence and absence of file extensions in the program
-
-    printf( "Syx2Ins  v%.2f    by Brandon Blume, July 2015\n\n", nVersion );
-
-    if (argc != 3) /* argc should be 3 for correct execution */
-    {
-        /* We print argv[0] assuming it is the program name */
-        printf( "usage:  %s  syxfile  insfile\n", argv[0] );
-        return 0;
-    }
-    else
-    {
-        /* Set up log file */
-        FILE *logFile = fopen( "log.txt", "w");
-        fprintf(logFile, "Syx2Ins v%.2f  Log File    by Brandon Blume, July 2015\n======================\nInput file: \"%s\"\n\n", nVersion, argv[1]);
-
-        /* We assume argv[1] is a filename to open */
-        FILE *filePointer = fopen( argv[1], "rb" );
-
-        /* Variables for adding missing file extension to first argument */
-        char *fileExt;
-        int filenameLen;
-
-        dot = strrchr(argv[1], '.');
-
-        if(!dot && filePointer == 0) /* check for file extension in argument */
-        {
-            //printf("No extension found in first argument and file does not exist.\nAdding SYX extension...\n");
-            fprintf(logFile, "No extension found in first argument and file does not exist.\nAdding SYX extension...\n");
-
-            filenameLen = strlen(argv[1]);
-            fileExt = malloc(filenameLen+5);
-            strncpy(fileExt, argv[1], filenameLen);
-            strcpy(fileExt + filenameLen, ".SYX");
-
-            filePointer = fopen( fileExt, "rb" );
-            if (filePointer == 0 )
-            {
-                printf("Failed.\n\nFile \"%s\" does not exist.\n", fileExt );
-                fprintf(logFile, "Failed.\n\nFile \"%s\" does not exist.\n", fileExt);
-                return 0;
-            }
-            //printf("Success! \"%s\" file found!\n\n", fileExt);
-            fprintf(logFile, "Success! \"%s\" file found!\n\n", fileExt);
-        }
-        else if( filePointer == 0)
-        {
-            printf("File \"%s\" does not exist.\n", argv[1]);
-            printf("File \"%s\" does not exist.\n", argv[1]);
-            fprintf(logFile, "File \"%s\" does not exist.\n", argv[1]);
-            return 0;
-        }
-
-        /* Successful file open, whether it had a dot or not, one was added */
-
-        /* Store entire file contents in memory then close the file to avoid tampering with it */
-        fseek(filePointer, 0, SEEK_END);
-        long fsize = ftell(filePointer);
-        fseek(filePointer, 0, SEEK_SET);
-
-        unsigned char *buffer = malloc(fsize + 1);
-        fread(buffer, fsize, 1, filePointer);
-        fclose(filePointer);
-
-        buffer[fsize] = 0; //Terminate end of buffer with NULL
-
-        /* Start searching for Roland send SysEx Command */
-        if( memcmp( buffer, sysexPattern, NUM( sysexPattern ) ) )
-        {
-            /* File exists, but no point in continuing since there is no Roland sysex header */
-            printf( "Not a valid MT-32 SysEx file.\nAborting...\n" );
-            fprintf(logFile, "MT-32 sysex header not found. Not a valid MT-32 SysEx file.\nAborting...\n" );
-        }
-        else
-        {
-            printf( "MT-32 sysex header found!\n" );
-            fprintf(logFile, "MT-32 sysex header found!\n" );
-
-            /* Proceed to next check: look for MT-32's 'write to dispay' command bytes
-            (0x20, 0x00, 0x00) and, if found, copy the following string and put it into
-            the gameTitle array to use for naming the patch list in the INS output file.
-            If not found, generate gameTitle array based on filename instead. */
-
-            if ( buffer[5] == 0x20 && buffer[6] == 0x00 && buffer[7] == 0x00 )
-            {
-                //printf( "Custom title text found! Generating list title name...\n\nString contents (20 characters):\n" );
-                //printf(" 1........10........20 \n"); //Mark positions for 20 LCD characters
-                //printf( "\[" );  //Contain LCD message string with square brackets
-                fprintf(logFile, "Custom title text found! Generating list title name...\n");
-
-                int i;
-
-                for ( i = 0; i < 20; i++ )
-                {
-                    gameTitle[i] = buffer[i+8];
-                    /* Display empty space characters (" ") instead of NULL ('\0') for display and log output only,
-                    doesn't actually change the value in the buffer or gameTitle arrays */
-                    /*if(buffer[i+8] == '\0')
-                    {
-                        //printf(" ");
-                        fprintf(logFile, " ");
-                    }
-                    else
-                    {
-                        //printf( "%c", buffer[i+8] );
-                        fprintf(logFile, "%c", buffer[i+8] );
-                    }*/
-                }
-                //printf( "]\n\n" );
-
-                /* We don't want preceding empty spaces in front of the text string
-                so we remove them for the gameTitle array */
-                if ( gameTitle[0] == 0x20)
-                {
-                    //printf("Preceding spaces found in text. Removing...\n");
-                    fprintf(logFile, "Preceding spaces found in title. Removing...\n");
-
-                    i = 0;
-                    while ( gameTitle[0] == 0x20 )
-                    {
-                        while ( i < NUM(gameTitle) - 1)
-                        {
-                            gameTitle[i] = gameTitle[i+1];
-                            i++;
-                        }
-                        i = 0;
-                    }
-                }
-                //else
-                //{
-                    /* No blank spaces found in LCD message string so no need to attempt to remove any */
-                    //printf("No preceding spaces found!\n");
-                    //fprintf(logFile, "No preceding spaces found!\n");
-                //}
-                //printf( "Done generating gameTitle!\n\n");
-                //printf("gameTitle:\n\[%s]\n\n", gameTitle );
-            }
-            else
-            {
-                //printf("No custom title text found.\nGenerating list title after filename instead...\n\n");
-                fprintf(logFile, "No custom title text found.\nGenerating list title after filename instead...\n\n");
-
-                int len;
-                dot = 0;
-
-                /* Get position of the last dot in the SYX filename */
-                dot = strrchr(argv[1], '.');
-                /* If a dot was found, calculate the length to this point */
-                if(dot) len = dot - argv[1];
-                else len = strlen(argv[1]);
-                /* Allocate a buffer big enough to hold the result. */
-                syxFilename = malloc(len+1);
-
-                int i;
-                for(i = 0; i < len+1; i++)
-                {
-                    syxFilename[i] = 0;
-                }
-                /* Build the new name */
-                strncpy(syxFilename, argv[1], len);
-                syxFilename[len+1] = 0;
-                strcpy(gameTitle, syxFilename);
-
-                //printf("argv\[1]:\n\[%s]\nand gameTitle:\n\[%s]\n\n",argv[1],gameTitle);
-            }
-
-            fprintf(logFile, "\[%s]\n\n", gameTitle );
-
-            /* ********************************************************************* */
-            /* Prepare timbre and patch names for INS file */
-
-            FILE *insFile;
-
-            dot = strrchr(argv[2], '.');
-
-            if(!dot) /* If there's no extension given, create it automatically */
-            {
-                //printf("No extension given for output INS file.\nAdding...\n\n");
-                fprintf(logFile, "No extension given for output INS file.\nAdding .INS extension...\n");
-
-                filenameLen = strlen(argv[2]);
-                fileExt = malloc(filenameLen+5);
-                strncpy(fileExt, argv[2], filenameLen);
-                strcpy(fileExt + filenameLen, ".INS");
-                insFile = fopen(fileExt, "r");
-                if(insFile != 0)
-                {
-                    printf("\nFile \"%s.INS\" already exists.\nAborting...\n", argv[2]);
-                    fprintf(logFile, "\nFile \"%s.INS\" already exists.\nAborting...", argv[2]);
-                    return 0;
-                }
-                insFile = fopen(fileExt, "w");
-            }
-            else
-            {
-                //printf("Extension given. Continuing normally...\n");
-
-                insFile = fopen(argv[2], "r");
-                if(insFile != 0)
-                {
-                    printf("\nFile \"%s\" already exists.\nAborting...\n", argv[2]);
-                    fprintf(logFile, "\nFile \"%s\" already exists.\nAborting...", argv[2]);
-                    return 0;
-                }
-                insFile = fopen(argv[2], "w");
-            }
-
-            /* Create list of default MT-32 patch names */
-            /* Group A stock patch names */
-            strcpy(stockPatches[0], "AcouPiano1");
-            strcpy(stockPatches[1], "AcouPiano2");
-            strcpy(stockPatches[2], "AcouPiano3");
-            strcpy(stockPatches[3], "ElecPiano1");
-            strcpy(stockPatches[4], "ElecPiano2");
-            strcpy(stockPatches[5], "ElecPiano3");
-            strcpy(stockPatches[6], "ElecPiano4");
-            strcpy(stockPatches[7], "Honkytonk");
-            strcpy(stockPatches[8], "Elec Org 1");
-            strcpy(stockPatches[9], "Elec Org 2");
-            strcpy(stockPatches[10], "Elec Org 3");
-            strcpy(stockPatches[11], "Elec Org 4");
-            strcpy(stockPatches[12], "Pipe Org 1");
-            strcpy(stockPatches[13], "Pipe Org 2");
-            strcpy(stockPatches[14], "Pipe Org 3");
-            strcpy(stockPatches[15], "Accordion");
-            strcpy(stockPatches[16], "Harpsi 1");
-            strcpy(stockPatches[17], "Harpsi 2");
-            strcpy(stockPatches[18], "Harpsi 3");
-            strcpy(stockPatches[19], "Clavi 1");
-            strcpy(stockPatches[20], "Clavi 2");
-            strcpy(stockPatches[21], "Clavi 3");
-            strcpy(stockPatches[22], "Celesta 1");
-            strcpy(stockPatches[23], "Celesta 2");
-            strcpy(stockPatches[24], "Syn Brass1");
-            strcpy(stockPatches[25], "Syn Brass2");
-            strcpy(stockPatches[26], "Syn Brass3");
-            strcpy(stockPatches[27], "Syn Brass4");
-            strcpy(stockPatches[28], "Syn Bass 1");
-            strcpy(stockPatches[29], "Syn Bass 2");
-            strcpy(stockPatches[30], "Syn Bass 3");
-            strcpy(stockPatches[31], "Syn Bass 4");
-            strcpy(stockPatches[32], "Fantasy");
-            strcpy(stockPatches[33], "Harmo Pan");
-            strcpy(stockPatches[34], "Chorale");
-            strcpy(stockPatches[35], "Glasses");
-            strcpy(stockPatches[36], "Soundtrack");
-            strcpy(stockPatches[37], "Atmosphere");
-            strcpy(stockPatches[38], "Warm Bell");
-            strcpy(stockPatches[39], "Funny Vox");
-            strcpy(stockPatches[40], "Echo Bell");
-            strcpy(stockPatches[41], "Ice Rain");
-            strcpy(stockPatches[42], "Oboe 2001");
-            strcpy(stockPatches[43], "Echo Pan");
-            strcpy(stockPatches[44], "DoctorSolo");
-            strcpy(stockPatches[45], "Schooldaze");
-            strcpy(stockPatches[46], "BellSinger");
-            strcpy(stockPatches[47], "SquareWave");
-            strcpy(stockPatches[48], "Str Sect 1");
-            strcpy(stockPatches[49], "Str Sect 2");
-            strcpy(stockPatches[50], "Str Sect 3");
-            strcpy(stockPatches[51], "Pizzicato");
-            strcpy(stockPatches[52], "Violin 1");
-            strcpy(stockPatches[53], "Violin 2");
-            strcpy(stockPatches[54], "Cello 1");
-            strcpy(stockPatches[55], "Cello 2");
-            strcpy(stockPatches[56], "Contrabass");
-            strcpy(stockPatches[57], "Harp 1");
-            strcpy(stockPatches[58], "Harp 2");
-            strcpy(stockPatches[59], "Guitar 1");
-            strcpy(stockPatches[60], "Guitar 2");
-            strcpy(stockPatches[61], "Elec Gtr 1");
-            strcpy(stockPatches[62], "Elec Gtr 2");
-            strcpy(stockPatches[63], "Sitar");
-            /* Group B stock patch names */
-            strcpy(stockPatches[64], "Acou Bass1");
-            strcpy(stockPatches[65], "Acou Bass2");
-            strcpy(stockPatches[66], "Elec Bass1");
-            strcpy(stockPatches[67], "Elec Bass2");
-            strcpy(stockPatches[68], "Slap Bass1");
-            strcpy(stockPatches[69], "Slap Bass2");
-            strcpy(stockPatches[70], "Fretless 1");
-            strcpy(stockPatches[71], "Fretless 2");
-            strcpy(stockPatches[72], "Flute 1");
-            strcpy(stockPatches[73], "Flute 2");
-            strcpy(stockPatches[74], "Piccolo 1");
-            strcpy(stockPatches[75], "Piccolo 2");
-            strcpy(stockPatches[76], "Recorder");
-            strcpy(stockPatches[77], "Pan Pipes");
-            strcpy(stockPatches[78], "Sax 1");
-            strcpy(stockPatches[79], "Sax 2");
-            strcpy(stockPatches[80], "Sax 3");
-            strcpy(stockPatches[81], "Sax 4");
-            strcpy(stockPatches[82], "Clarinet 1");
-            strcpy(stockPatches[83], "Clarinet 2");
-            strcpy(stockPatches[84], "Oboe");
-            strcpy(stockPatches[85], "Engl Horn");
-            strcpy(stockPatches[86], "Bassoon");
-            strcpy(stockPatches[87], "Harmonica");
-            strcpy(stockPatches[88], "Trumpet 1");
-            strcpy(stockPatches[89], "Trumpet 2");
-            strcpy(stockPatches[90], "Trombone 1");
-            strcpy(stockPatches[91], "Trombone 2");
-            strcpy(stockPatches[92], "Fr Horn 1");
-            strcpy(stockPatches[93], "Fr Horn 2");
-            strcpy(stockPatches[94], "Tuba");
-            strcpy(stockPatches[95], "Brs Sect 1");
-            strcpy(stockPatches[96], "Brs Sect 2");
-            strcpy(stockPatches[97], "Vibe 1");
-            strcpy(stockPatches[98], "Vibe 2");
-            strcpy(stockPatches[99], "Syn Mallet");
-            strcpy(stockPatches[100], "Wind Bell");
-            strcpy(stockPatches[101], "Glock");
-            strcpy(stockPatches[102], "Tube Bell");
-            strcpy(stockPatches[103], "Xylophone");
-            strcpy(stockPatches[104], "Marimba");
-            strcpy(stockPatches[105], "Koto");
-            strcpy(stockPatches[106], "Sho");
-            strcpy(stockPatches[107], "Shakuhachi");
-            strcpy(stockPatches[108], "Whistle 1");
-            strcpy(stockPatches[109], "Whistle 2");
-            strcpy(stockPatches[110], "Bottleblow");
-            strcpy(stockPatches[111], "Breathpipe");
-            strcpy(stockPatches[112], "Timpani");
-            strcpy(stockPatches[113], "MelodicTom");
-            strcpy(stockPatches[114], "Deep Snare");
-            strcpy(stockPatches[115], "Elec Perc1");
-            strcpy(stockPatches[116], "Elec Perc2");
-            strcpy(stockPatches[117], "Taiko");
-            strcpy(stockPatches[118], "Taiko Rim");
-            strcpy(stockPatches[119], "Cymbal");
-            strcpy(stockPatches[120], "Castanets");
-            strcpy(stockPatches[121], "Triangle");
-            strcpy(stockPatches[122], "Orche Hit");
-            strcpy(stockPatches[123], "Telephone");
-            strcpy(stockPatches[124], "Bird Tweet");
-            strcpy(stockPatches[125], "OneNoteJam");
-            strcpy(stockPatches[126], "WaterBells");
-            strcpy(stockPatches[127], "JungleTune");
-
-            /* We will fill in all the spaces in the new INS patch list (newPatches) with
-            the stock list first before searching for the custom timbre names to imitate
-            the default MT-32 patch listing, this way if the custom SysEx data doesn't
-            replace every patch listing (they usually don't) they won't show up empty in
-            our new list */
-            int j;
-            for(j = 0; j < 127; j++)
-                strcpy(newPatches[j], stockPatches[j]);
-
-            unsigned long ii;
-            int nTimbre = 0;
-            int k = 0;
-
-            printf("Cataloging custom timbre names...\n");
-            fprintf(logFile, "Cataloging custom timbre names...\n");
-
-            /* Search for "timbre set" command pattern matches in buffer (08 xx xx), position = ii */
-            for ( ii = 0; ii <= fsize - sizeof(timbreSet); ii++ )
-            {
-                if ( buffer[ii] == timbreSet[0] )
-                {
-                    if ( ( memcmp( &buffer[ii], timbreSet, sizeof( timbreSet ) ) ) == 0 )
-                    {
-                        /* Pattern match found, proceed to copy timbre name */
-
-                        //printf("Timbre sysex pattern found! (%d)\n", nTimbre);
-                        //fprintf(logFile, "Timbre sysex pattern found! (%d)\n", nTimbre);
-
-                        /* We advance the pointer position to the length of the command bytes + 2
-                        for the extra required two bytes to get to the beginning of the timbre name */
-                        ii += sizeof(timbreSet) + 2;
-                        //fprintf(logFile, "Position of discovered instrument name in buffer: %lu\n", ii);
-
-                        /* Copy the custom patch name for the file into the custom timbre list */
-                        //strncpy(customTimbres[nTimbre], &buffer[ii], 10);
-
-                        for(k = 0; k < 10; k++)
-                        {
-                            //printf("%d", k);
-                            customTimbres[nTimbre][k] = buffer[ii+k];
-                        }
-                        customTimbres[nTimbre][10] = 0;
-                        //printf("%s\n", customTimbres[nTimbre]);
-                        nTimbre++;
-                    }
-                }
-            }
-
-            /* Begin algorithm for discovering custom Patch list names. This is different from
-            the 64-instrument custom timbre list we just generated as that list is usually not
-            necessarily in the same order as the full 128-instrument Patch list. The final Patch
-            list is generated from three sources (or groups of timbres):
-            Default Preset Group A 0-63
-            Default Preset Group B 64-127
-            Custom Timbre Group 0-63 */
-
-            /* First step: iterate through the SYX file to find instances of
-            the "05 xx xx" byte codes (there are 4, 32 instruments each) */
-            printf("Generating final instrument list...\n\n");
-            fprintf(logFile, "Generating final instrument list...\n\n");
-
-            int nPatch = 0;
-            int i = 0;
-            for ( ii = 0; ii <= fsize - sizeof(patchSet); ii++ )
-            {
-                if ( buffer[ii] == patchSet[0] )
-                {
-                    if ( ( memcmp( &buffer[ii], patchSet, sizeof( patchSet ) ) ) == 0 )
-                    {
-                        /* Pattern found */
-
-                        //printf("Patch set pattern found! (%d)\n", nPatch);
-                        //fprintf(logFile, "Patch set pattern found! (%d)\n", nPatch);
-
-
-                        /* We advance the pointer position to the length of the command bytes + 2
-                        for the extra required two bytes to get to the actual patch data after the pattern and identifying code */
-                        ii += sizeof(patchSet) + 2;
-
-                        /* Second step: Now that we have found the first point of data, we need to iterate through
-                        all 32 sets of patch information in this iterated instance of the "05 xx xx" pattern (128 altogether).
-                        Every 8 bytes is a new entry for a total of 256 bytes per data block */
-
-                        for(i = 0; i < 32; i++)
-                        {
-                            /* These conditional statements determine whether the instrument is from Preset Group A,
-                            Preset Group B, or the Custom Timbre memory group */
-                            if (buffer[ii] == 0x00 && buffer[ii+2] != 0x00)
-                            {
-                                //printf("buffer\[ii] = Group A!\n");
-                                strcpy( newPatches[nPatch], stockPatches[ buffer[ii + 1] ]);
-                            }
-                            else if(buffer[ii] == 0x01)
-                            {
-                                //printf("buffer\[ii] = Group B!\n");
-                                strcpy( newPatches[nPatch], stockPatches[ buffer[ii+1] + 64 ] );
-                            }
-                            else if(buffer[ii] == 0x02)
-                            {
-                                //printf("buffer\[ii] = Custom Timbre!\n");
-                                strcpy( newPatches[nPatch], customTimbres[ buffer[ii + 1] ] );
-                            }
-
-                            fprintf(logFile, "%s\n", newPatches[nPatch]);
-                            printf(".");
-                            nPatch++;
-
-                            ii += 8;
-                        }
-                    }
-                }
-            }
-            printf("\n\nGenerating INS file...\n\n");
-            fprintf(logFile, "\nGenerating INS file...\n\n");
-
-            /* Begin generating INS file */
-
-            fprintf(insFile, "\n; ----------------------------------------------------------------------\n\n.Patch Names\n\n\n");
-            fprintf(insFile, "\[%s", gameTitle);
-            fprintf(insFile, " Patch Bank]\n");
-
-            /* We iterate through the stored patch list in newPatches and print them to our new INS file */
-            for ( i = 0; i < 128; i++)
-                fprintf(insFile, "%d=%s\n", i, newPatches[i]);
-
-            fprintf(insFile, "\n; ----------------------------------------------------------------------\n\n.Note Names\n\n");
-            fprintf(insFile, "\n; ----------------------------------------------------------------------\n\n.Instrument Definitions\n\n");
-            fprintf(insFile, "\n\[%s Patch Bank]\nPatch\[*]=%s Patch Bank\n", gameTitle, gameTitle);
-
-            fclose(insFile);
-        }
-        printf("DONE!\n");
-        fprintf(logFile, "DONE!\n");
-        fclose(logFile);
-    }
-    return 0;
-}
+/********************************************************************************
+*	SYX2INS conversion utility   v1.00		    	    		*
+*	by Brandon Blume					    		*
+*	July 11, 2015						    		*
+*								    		*
+*	Command line tool to pull/generate the instrument patch list		*
+*	from a custom MT-32 programmed SYX dump file into 	    		*
+*	Cakewalk/Sonar's INS format (MIDI instrument list).	    		*
+*								    		*
+*	You're free to do with it as you please. This program could 		*
+*	probably be vastly improved to be more efficient, but it works.		*
+*	It's also missing error handling for a couple instances where		*
+*	MIDI command data might not exist partway through the SYX file.		*
+********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <time.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#include "syx2ins.h"
+#include "cache.h"
+#include "fileio.h"
+#include "timbreidx.h"
+#include "logging.h"
+#include "emit.h"
+#include "capture.h"
+#include "container.h"
+#include "archive.h"
+#include "insmerge.h"
+
+/* ********************************************************************* */
+/* Batch mode: convert a whole directory or list of SYX files on a pool of worker threads */
+
+enum
+{
+    JOB_PENDING,
+    JOB_OK,
+    JOB_READ_ERROR,
+    JOB_NOT_MT32,
+    JOB_EXISTS,
+    JOB_WRITE_ERROR
+};
+
+static const char *statusText[] = { "", "", "can't be read", "has no MT-32 SysEx in it", "INS already exists", "can't write INS" };
+
+/* Each job owns its result and each worker its parse state, so workers never share anything writable */
+typedef struct
+{
+    char *syxPath;                  //"archive:member" for a dump inside an archive
+    char *insPath;                  //Output file, or NULL when writing one combined INS
+    const Archive *archive;         //Archive the dump is in, NULL for a plain file
+    int member;
+    Syx2InsResult result;
+    int status;
+    int fromCache;                  //Result came from the cache, nothing was parsed
+    int unchanged;                  //Output already held this INS, nothing was written
+    ConversionMetrics metrics;
+} BatchJob;
+
+/* Jobs [head, tail) still waiting in one worker's queue. The owner takes from
+the head, idle workers steal from the tail. */
+typedef struct
+{
+    pthread_mutex_t lock;
+    int head, tail;
+} WorkQueue;
+
+typedef struct
+{
+    BatchJob *jobs;
+    WorkQueue *queues;
+    int nWorkers;
+    ConversionCache *cache;         //NULL when not caching
+    int replace;                    //Existing INS files may be replaced
+    LogSink *log;
+} BatchPool;
+
+typedef struct
+{
+    BatchPool *pool;
+    int self;
+    Syx2InsState state;             //Scratch space, reused for every job this worker runs
+} BatchWorker;
+
+static int takeJob(BatchPool *pool, int self)
+{
+    int n, job = -1;
+
+    for (n = 0; n < pool->nWorkers && job < 0; n++)
+    {
+        WorkQueue *q = &pool->queues[(self + n) % pool->nWorkers];
+
+        pthread_mutex_lock(&q->lock);
+        if (q->head < q->tail)
+            job = n == 0 ? q->head++ : --q->tail;
+        pthread_mutex_unlock(&q->lock);
+    }
+    return job;
+}
+
+/* Formats written for every output, set from -format before any work starts */
+static unsigned outputFormats = FORMAT_MASK(FORMAT_INS);
+
+/* -merge: banks go into an existing INS instead of never touching it */
+static int mergeOutput;
+
+/* -uploads: a bank per upload in a capture rather than one for the whole file */
+static int splitUploads;
+
+/* What cached results and outputs were made with besides the input: the formats,
+how they are rendered and how captures are split */
+static void cacheOptionsKey(char key[64])
+{
+    sprintf(key, "formats %x/%d uploads %d", outputFormats, EMIT_SCHEMA, splitUploads);
+}
+
+/* Write one output file. Unless replace is set an existing file is never
+overwritten, same as single file mode. Rebuilds (with a cache) and watch mode
+replace it atomically instead, and with a cache a file that still holds what we
+wrote last time is left alone. With -merge an existing INS gets the banks added
+or replaced in it instead. */
+static int writeOutputFile(const char *path, OutputFormat format, const Syx2InsResult *banks, int nBanks, const ConversionCache *cache, int replace, int *unchanged)
+{
+    OutputBuffer out;
+    uint64_t hash;
+    struct stat info;
+    int status = JOB_OK;
+
+    *unchanged = 0;
+    if (!emitRender(format, banks, nBanks, &out))
+        return JOB_WRITE_ERROR;
+
+    hash = syx2insHash(out.data, out.size, SYX2INS_HASH_SEED);
+    *unchanged = cache && cacheOutputUnchanged(cache, path, hash);
+
+    if (*unchanged)
+        ;
+    else if (format == FORMAT_INS && mergeOutput && stat(path, &info) == 0)
+    {
+        if (!insMergeFile(path, out.data, out.size))
+            status = JOB_WRITE_ERROR;
+        else if (cache)
+            cacheRememberOutput(cache, path, hash);
+    }
+    else if (!replace && stat(path, &info) == 0)
+        status = JOB_EXISTS;
+    else if (!writeFileAtomic(path, out.data, out.size))
+        status = JOB_WRITE_ERROR;
+    else if (cache)
+        cacheRememberOutput(cache, path, hash);
+
+    emitFree(&out);
+    return status;
+}
+
+/* Write every selected format of one output. insPath names the INS, the other
+formats go next to it with their own extensions. */
+static int writeBatchOutput(const char *insPath, const Syx2InsResult *banks, int nBanks, const ConversionCache *cache, int replace, int *unchanged)
+{
+    int f, status = JOB_OK, written, same;
+    char *path;
+
+    *unchanged = 1;
+    for (f = 0; f < NUM_FORMATS; f++)
+    {
+        if (!(outputFormats & FORMAT_MASK(f)))
+            continue;
+
+        path = f == FORMAT_INS ? (char *)insPath : emitPath(insPath, f);
+        written = writeOutputFile(path, f, banks, nBanks, cache, replace, &same);
+        if (status == JOB_OK)
+            status = written;
+        *unchanged = *unchanged && same;
+        if (path != insPath)
+            free(path);
+    }
+    return status;
+}
+
+/* Add what a converted dump set to its metrics */
+static void countResolved(ConversionMetrics *metrics, const Syx2InsResult *result)
+{
+    int i;
+
+    for (i = 0; i < 64; i++)
+        metrics->timbresResolved += result->timbreWritten[i];
+    for (i = 0; i < 128; i++)
+        metrics->patchesResolved += result->patchWritten[i];
+    metrics->damagedMessages += result->diagnostics.total;
+}
+
+static const char *problemText[SYX2INS_NUM_PROBLEMS] =
+{
+    "ok",
+    "truncated, skipped",
+    "bad checksum, skipped",
+    "runs past the end of its memory area, cut off"
+};
+
+/* One line per damaged message the dump had, then how many more there were */
+static void logDiagnostics(Logger *logger, const char *path, const Syx2InsDiagnostics *diagnostics)
+{
+    const Syx2InsDiagnostic *diagnostic;
+    unsigned long i;
+
+    for (i = 0; i < diagnostics->total && i < SYX2INS_MAX_DIAGNOSTICS; i++)
+    {
+        diagnostic = &diagnostics->first[i];
+        logPrint(logger, LOG_SUMMARY, "%s: offset %lu, address %02lX %02lX %02lX, %lu bytes: %s\n", path, (unsigned long)diagnostic->offset,
+            diagnostic->address >> 14, (diagnostic->address >> 7) & 0x7F, diagnostic->address & 0x7F,
+            (unsigned long)diagnostic->length, problemText[diagnostic->problem]);
+    }
+    if (diagnostics->total > SYX2INS_MAX_DIAGNOSTICS)
+        logPrint(logger, LOG_SUMMARY, "%s: %lu more damaged messages\n", path, diagnostics->total - SYX2INS_MAX_DIAGNOSTICS);
+}
+
+/* Convert one input, going through the cache when there is one. An input whose
+stat() matches the last run is looked up by its recorded content hash without
+reading it, a changed one is hashed and only parsed if that content is new. A
+dump inside an archive goes by the stat() of the archive. The hash is only
+recorded for the stat() if the file looked the same before and after reading it,
+otherwise the hash may belong to older contents. */
+static void convertJob(BatchJob *job, Syx2InsState *state, const ConversionCache *cache, int replace)
+{
+    ConversionMetrics *metrics = &job->metrics;
+    const char *statPath = job->archive ? job->archive->path : job->syxPath;
+    InputFile input;
+    struct stat info, after;
+    uint64_t contentHash = 0;
+    int converted, haveInput = 0, opened, haveStat = 0;
+    double start = metricsNow(), now;
+
+    if (cache)
+        haveStat = stat(statPath, &info) == 0;
+    if (haveStat && cacheLookupInput(cache, job->syxPath, &info, &contentHash))
+        job->fromCache = cacheLoadResult(cache, contentHash, &converted, &job->result);
+
+    if (!job->fromCache)
+    {
+        opened = job->archive ? archiveLoad(job->archive, job->member, &input) : openInput(job->syxPath, &input);
+        if (!opened)
+        {
+            job->status = JOB_READ_ERROR;
+            return;
+        }
+        haveInput = 1;
+        metrics->bytesScanned = input.size;
+
+        if (cache)
+        {
+            contentHash = syx2insHash(input.data, input.size, SYX2INS_HASH_SEED);
+            if (haveStat && stat(statPath, &after) == 0 && cacheSameStat(&info, &after))
+                cacheRememberInput(cache, job->syxPath, &after, contentHash);
+            job->fromCache = cacheLoadResult(cache, contentHash, &converted, &job->result);
+        }
+    }
+    now = metricsNow();
+    metrics->loadSeconds = now - start;
+    start = now;
+
+    if (!job->fromCache)
+    {
+        converted = SYX2INS_NOT_MT32;
+        syx2insReset(state);
+        if (containerParse(containerDetect(input.data, input.size), state, input.data, input.size, 1))
+        {
+            metrics->messagesFramed = state->nMessages;
+            now = metricsNow();
+            metrics->parseSeconds = now - start;
+            start = now;
+
+            syx2insResolve(state, &job->result);
+            converted = SYX2INS_OK;
+        }
+        if (cache)
+            cacheStoreResult(cache, contentHash, converted, &job->result);
+    }
+    if (haveInput)
+        closeInput(&input);
+    now = metricsNow();
+    metrics->resolveSeconds = now - start;
+    start = now;
+
+    if (converted != SYX2INS_OK)
+    {
+        job->status = JOB_NOT_MT32;
+        return;
+    }
+    if (!job->result.haveTitle)
+        syx2insTitleFromPath(job->syxPath, job->result.title);
+    countResolved(metrics, &job->result);
+
+    job->status = JOB_OK;
+    if (job->insPath)
+    {
+        job->status = writeBatchOutput(job->insPath, &job->result, 1, cache, replace, &job->unchanged);
+        metrics->emitSeconds = metricsNow() - start;
+    }
+}
+
+/* Convert one input and log what happened in one go */
+static void runJob(BatchJob *job, Syx2InsState *state, const ConversionCache *cache, int replace, LogSink *log)
+{
+    Logger logger;
+    int i;
+
+    job->status = JOB_PENDING;
+    job->fromCache = 0;
+    job->unchanged = 0;
+    memset(&job->metrics, 0, sizeof(job->metrics));
+
+    convertJob(job, state, cache, replace);
+
+    job->metrics.files = 1;
+    job->metrics.failed = job->status != JOB_OK;
+    job->metrics.fromCache = job->fromCache;
+
+    loggerBegin(&logger, log);
+    if (job->status != JOB_OK)
+        logPrint(&logger, LOG_SUMMARY, "%s: %s\n", job->syxPath, statusText[job->status]);
+    else
+    {
+        logPrint(&logger, LOG_SUMMARY, "%s: [%s] %lu patches, %lu timbres%s%s\n", job->syxPath, job->result.title,
+            job->metrics.patchesResolved, job->metrics.timbresResolved, job->fromCache ? ", cached" : "", job->unchanged ? ", unchanged" : "");
+        logDiagnostics(&logger, job->syxPath, &job->result.diagnostics);
+        if (logEnabled(&logger, LOG_TRACE))
+            for (i = 0; i < 128; i++)
+                if (job->result.patchWritten[i])
+                    logPrint(&logger, LOG_TRACE, "    %d=%s\n", i, job->result.patchNames[i]);
+    }
+    loggerEnd(&logger);
+}
+
+static void *batchWorker(void *arg)
+{
+    BatchWorker *worker = arg;
+    int job;
+
+    while ((job = takeJob(worker->pool, worker->self)) >= 0)
+        runJob(&worker->pool->jobs[job], &worker->state, worker->pool->cache, worker->pool->replace, worker->pool->log);
+    return 0;
+}
+
+/* .SYX dumps, MIDI files and SCI patch resources, the last only by their usual name */
+static int isInputName(const char *name)
+{
+    static const char *extensions[] = { ".syx", ".mid", ".midi", ".smf" };
+    const char *base = strrchr(name, '/'), *dot = strrchr(name, '.');
+    int i;
+
+    if (!strcasecmp(base ? base + 1 : name, "patch.001"))
+        return 1;
+    for (i = 0; dot && i < (int)(sizeof(extensions) / sizeof(*extensions)); i++)
+        if (!strcasecmp(dot, extensions[i]))
+            return 1;
+    return 0;
+}
+
+static void addInput(char ***paths, int *nPaths, int *capacity, const char *path)
+{
+    if (*nPaths == *capacity)
+    {
+        *capacity = *capacity ? *capacity * 2 : 256;
+        *paths = realloc(*paths, *capacity * sizeof(**paths));
+    }
+    (*paths)[(*nPaths)++] = strdup(path);
+}
+
+/* Recursively collect every input file below a directory */
+static void collectDirectory(const char *dirName, char ***paths, int *nPaths, int *capacity)
+{
+    DIR *dir = opendir(dirName);
+    struct dirent *entry;
+    struct stat info;
+    char *path;
+
+    if (!dir)
+        return;
+
+    while ((entry = readdir(dir)) != 0)
+    {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+
+        path = malloc(strlen(dirName) + strlen(entry->d_name) + 2);
+        sprintf(path, "%s/%s", dirName, entry->d_name);
+
+        if (stat(path, &info) == 0)
+        {
+            if (S_ISDIR(info.st_mode))
+                collectDirectory(path, paths, nPaths, capacity);
+            else if (isInputName(entry->d_name) || archiveIsArchive(entry->d_name))
+                addInput(paths, nPaths, capacity, path);
+        }
+        free(path);
+    }
+    closedir(dir);
+}
+
+/* A list file has one SYX path per line, blank lines and lines starting with ';' are skipped */
+static void collectListFile(const char *listName, char ***paths, int *nPaths, int *capacity)
+{
+    FILE *listFile = fopen(listName, "r");
+    char line[4096];
+    size_t len;
+
+    if (!listFile)
+        return;
+
+    while (fgets(line, sizeof(line), listFile))
+    {
+        len = strcspn(line, "\r\n");
+        line[len] = 0;
+        if (len && line[0] != ';')
+            addInput(paths, nPaths, capacity, line);
+    }
+    fclose(listFile);
+}
+
+static int comparePaths(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Output path for per-file mode: same base name with an .INS extension, placed
+in outDir if one was given or next to the input otherwise */
+static char *batchInsPath(const char *syxPath, const char *outDir)
+{
+    const char *base = syxPath, *p, *dot;
+    size_t dirLen, baseLen;
+    char *insPath;
+
+    for (p = syxPath; *p; p++)
+        if (*p == '/' || *p == '\\')
+            base = p + 1;
+
+    dot = strrchr(base, '.');
+    baseLen = dot ? (size_t)(dot - base) : strlen(base);
+    dirLen = outDir ? strlen(outDir) + 1 : (size_t)(base - syxPath);
+
+    insPath = malloc(dirLen + baseLen + 5);
+    if (outDir)
+        sprintf(insPath, "%s/", outDir);
+    else
+        memcpy(insPath, syxPath, dirLen);
+    memcpy(insPath + dirLen, base, baseLen);
+    strcpy(insPath + dirLen + baseLen, ".INS");
+    return insPath;
+}
+
+static const Syx2InsResult *sortBanks;
+
+/* Order bank numbers by title, equal titles keep their input order */
+static int compareTitles(const void *a, const void *b)
+{
+    int cmp = strcmp(sortBanks[*(const int *)a].title, sortBanks[*(const int *)b].title);
+
+    return cmp ? cmp : *(const int *)a - *(const int *)b;
+}
+
+/* Two dumps with the same display text would give two banks with the same name
+in a combined INS, so later ones get a number appended */
+static void makeUniqueTitles(Syx2InsResult *banks, int nBanks)
+{
+    int *order = malloc(nBanks * sizeof(*order));
+    int i, n;
+    char suffix[16];
+    char *title;
+
+    for (i = 0; i < nBanks; i++)
+        order[i] = i;
+
+    sortBanks = banks;
+    qsort(order, nBanks, sizeof(*order), compareTitles);
+
+    for (i = 1, n = 1; i < nBanks; i++)
+    {
+        if (strcmp(banks[order[i]].title, banks[order[i-n]].title))
+        {
+            n = 1;
+            continue;
+        }
+
+        sprintf(suffix, " #%d", ++n);
+        title = banks[order[i]].title;
+        if (strlen(title) + strlen(suffix) > 20)
+            title[20 - strlen(suffix)] = 0;
+        strcat(title, suffix);
+    }
+    free(order);
+}
+
+/* Command line options of batch and watch mode */
+typedef struct
+{
+    const char *outDir;             //Where per-file INS go, NULL for next to each input
+    const char *combinedIns;        //Single INS for every bank, NULL for one INS per input
+    const char *cacheDir;           //Conversion cache, NULL for none
+    const char *indexFile;          //Timbre index to bring up to date, NULL for none
+    int dedupe;                     //Leave banks that play the same as an earlier one out of the combined INS
+    int nWorkers;
+    LogSink *log;
+    const char *metricsFile;        //JSON metrics of the run, NULL for none
+} BatchOptions;
+
+/* Gather the input files of a directory or list file, sorted since directory order
+is arbitrary and a combined INS should always come out the same. An archive on
+its own is one input, expandArchives() looks inside it. */
+static int collectInputs(const char *input, char ***paths, int *nPaths)
+{
+    struct stat info;
+    int capacity = 0;
+
+    *paths = 0;
+    *nPaths = 0;
+
+    if (stat(input, &info) != 0)
+    {
+        printf("File \"%s\" does not exist.\n", input);
+        return 0;
+    }
+    if (S_ISDIR(info.st_mode))
+        collectDirectory(input, paths, nPaths, &capacity);
+    else if (archiveIsArchive(input))
+        addInput(paths, nPaths, &capacity, input);
+    else
+        collectListFile(input, paths, nPaths, &capacity);
+
+    if (*nPaths == 0)
+    {
+        printf("No input files found in \"%s\".\n", input);
+        return 0;
+    }
+    qsort(*paths, *nPaths, sizeof(**paths), comparePaths);
+    return 1;
+}
+
+/* Run every job on a pool of nWorkers threads */
+static void runJobs(BatchJob *jobs, int nJobs, int nWorkers, ConversionCache *cache, int replace, LogSink *log)
+{
+    BatchPool pool;
+    BatchWorker *workers;
+    pthread_t *threads;
+    int i;
+
+    if (nWorkers > nJobs)
+        nWorkers = nJobs;
+
+    pool.jobs = jobs;
+    pool.queues = calloc(nWorkers, sizeof(*pool.queues));
+    pool.nWorkers = nWorkers;
+    pool.cache = cache;
+    pool.replace = replace;
+    pool.log = log;
+    workers = calloc(nWorkers, sizeof(*workers));
+    threads = calloc(nWorkers, sizeof(*threads));
+
+    /* Hand every worker an equal contiguous slice to start with, stealing evens it out */
+    for (i = 0; i < nWorkers; i++)
+    {
+        pthread_mutex_init(&pool.queues[i].lock, 0);
+        pool.queues[i].head = (int)((long long)nJobs * i / nWorkers);
+        pool.queues[i].tail = (int)((long long)nJobs * (i + 1) / nWorkers);
+    }
+
+    printf("Converting %d files on %d threads...\n", nJobs, nWorkers);
+
+    for (i = 0; i < nWorkers; i++)
+    {
+        workers[i].pool = &pool;
+        workers[i].self = i;
+        pthread_create(&threads[i], 0, batchWorker, &workers[i]);
+    }
+    for (i = 0; i < nWorkers; i++)
+        pthread_join(threads[i], 0);
+
+    for (i = 0; i < nWorkers; i++)
+        pthread_mutex_destroy(&pool.queues[i].lock);
+    free(pool.queues);
+    free(workers);
+    free(threads);
+}
+
+static const BatchJob *sortJobs;
+
+/* Order job numbers by sound hash, equal sounds keep their input order */
+static int compareSounds(const void *a, const void *b)
+{
+    uint64_t ha = sortJobs[*(const int *)a].result.soundHash, hb = sortJobs[*(const int *)b].result.soundHash;
+
+    if (ha != hb)
+        return ha < hb ? -1 : 1;
+    return *(const int *)a - *(const int *)b;
+}
+
+/* Mark every converted job that plays exactly like an earlier one, whatever its
+patches and timbres are called */
+static unsigned char *findDuplicateSounds(const BatchJob *jobs, int nJobs)
+{
+    unsigned char *duplicate = calloc(nJobs ? nJobs : 1, 1);
+    int *order = malloc((nJobs ? nJobs : 1) * sizeof(*order));
+    int i, n = 0;
+
+    for (i = 0; i < nJobs; i++)
+        if (jobs[i].status == JOB_OK)
+            order[n++] = i;
+
+    sortJobs = jobs;
+    qsort(order, n, sizeof(*order), compareSounds);
+
+    for (i = 1; i < n; i++)
+        if (jobs[order[i]].result.soundHash == jobs[order[i-1]].result.soundHash)
+            duplicate[order[i]] = 1;
+
+    free(order);
+    return duplicate;
+}
+
+/* Write every converted bank into one INS. Returns 0 if it can't be written. */
+static int writeCombinedIns(const BatchJob *jobs, int nJobs, const char *combinedIns, const ConversionCache *cache, int replace, int dedupe, int *unchanged)
+{
+    Syx2InsResult *banks = malloc(nJobs * sizeof(*banks));
+    unsigned char *duplicate = dedupe ? findDuplicateSounds(jobs, nJobs) : 0;
+    int i, nBanks = 0, status;
+
+    for (i = 0; i < nJobs; i++)
+        if (jobs[i].status == JOB_OK && !(duplicate && duplicate[i]))
+            banks[nBanks++] = jobs[i].result;
+    free(duplicate);
+
+    makeUniqueTitles(banks, nBanks);
+    status = writeBatchOutput(combinedIns, banks, nBanks, cache, replace, unchanged);
+    free(banks);
+
+    if (status != JOB_OK)
+        printf("Can't write \"%s\".\n", combinedIns);
+    return status == JOB_OK;
+}
+
+/* Put the custom timbres of every converted file into the index, keeping what it
+already knew about files that weren't part of this run */
+static int updateTimbreIndex(const BatchJob *jobs, int nJobs, const char *indexFile)
+{
+    TimbreIndexBuilder builder;
+    TimbreIndex old;
+    int i, ok;
+
+    timbreIndexBuilderInit(&builder);
+    for (i = 0; i < nJobs; i++)
+        if (jobs[i].status == JOB_OK || jobs[i].status == JOB_EXISTS)
+            timbreIndexAddFile(&builder, jobs[i].syxPath, &jobs[i].result);
+
+    if (timbreIndexOpen(&old, indexFile))
+    {
+        timbreIndexKeepOld(&builder, &old);
+        timbreIndexClose(&old);
+    }
+
+    ok = timbreIndexWrite(&builder, indexFile);
+    if (ok)
+        printf("%lu timbres from %lu files in \"%s\".\n", (unsigned long)builder.nRecords, (unsigned long)builder.nFiles, indexFile);
+    else
+        printf("Can't write \"%s\".\n", indexFile);
+    timbreIndexBuilderFree(&builder);
+    return ok;
+}
+
+/* Order job numbers by output path, equal paths keep their input order */
+static int compareInsPaths(const void *a, const void *b)
+{
+    int cmp = strcmp(sortJobs[*(const int *)a].insPath, sortJobs[*(const int *)b].insPath);
+
+    return cmp ? cmp : *(const int *)a - *(const int *)b;
+}
+
+static int compareInsPathKey(const void *key, const void *job)
+{
+    return strcmp(key, sortJobs[*(const int *)job].insPath);
+}
+
+/* insPath with -n put in front of the extension */
+static char *numberedInsPath(const char *insPath, int n)
+{
+    const char *dot = strrchr(insPath, '.');
+    size_t stemLen = dot ? (size_t)(dot - insPath) : strlen(insPath);
+    char *path = malloc(strlen(insPath) + 16);
+
+    sprintf(path, "%.*s-%d%s", (int)stemLen, insPath, n, dot ? dot : "");
+    return path;
+}
+
+/* 1 if some input's own output path or a name given out already is path */
+static int isInsPathTaken(const char *path, const int *order, int nJobs, char **chosen, int nChosen)
+{
+    int i;
+
+    if (bsearch(path, order, nJobs, sizeof(*order), compareInsPathKey))
+        return 1;
+    for (i = 0; i < nChosen; i++)
+        if (!strcmp(path, chosen[i]))
+            return 1;
+    return 0;
+}
+
+/* Inputs only keep their base name in the output, so song.syx and song.mid, or
+patch.001 from two games put into one outdir, would write the same INS. The
+first one in input order keeps the name, the others get -2, -3 and so on. */
+static void makeUniqueInsPaths(BatchJob *jobs, int nJobs)
+{
+    int *order = malloc((nJobs + 1) * sizeof(*order));
+    char **renamed = calloc(nJobs + 1, sizeof(*renamed));
+    char **chosen = malloc((nJobs + 1) * sizeof(*chosen));
+    int i, first, n, nChosen = 0;
+
+    sortJobs = jobs;
+    for (i = 0; i < nJobs; i++)
+        order[i] = i;
+    qsort(order, nJobs, sizeof(*order), compareInsPaths);
+
+    /* Work out every new name against the sorted old ones first, then rename */
+    for (first = 0, i = 1, n = 2; i < nJobs; i++)
+    {
+        if (strcmp(jobs[order[i]].insPath, jobs[order[first]].insPath))
+        {
+            first = i;
+            n = 2;
+            continue;
+        }
+        /* Skip numbers some other input's name already ends in, or another
+        collision was given */
+        for (;; n++)
+        {
+            renamed[order[i]] = numberedInsPath(jobs[order[i]].insPath, n);
+            if (!isInsPathTaken(renamed[order[i]], order, nJobs, chosen, nChosen))
+                break;
+            free(renamed[order[i]]);
+        }
+        chosen[nChosen++] = renamed[order[i]];
+        n++;
+        printf("%s and %s both make \"%s\", writing \"%s\" for the second.\n",
+            jobs[order[first]].syxPath, jobs[order[i]].syxPath, jobs[order[i]].insPath, renamed[order[i]]);
+    }
+
+    for (i = 0; i < nJobs; i++)
+    {
+        if (renamed[i])
+        {
+            free(jobs[i].insPath);
+            jobs[i].insPath = renamed[i];
+        }
+    }
+    free(chosen);
+    free(renamed);
+    free(order);
+}
+
+static BatchJob *createJobs(char **paths, int nPaths, const BatchOptions *options)
+{
+    BatchJob *jobs = calloc(nPaths, sizeof(*jobs));
+    int i;
+
+    for (i = 0; i < nPaths; i++)
+    {
+        jobs[i].syxPath = paths[i];
+        jobs[i].insPath = options->combinedIns ? 0 : batchInsPath(paths[i], options->outDir);
+    }
+    return jobs;
+}
+
+/* Output path of a dump inside an archive: named after the dump, placed in outDir
+if one was given or next to the archive otherwise */
+static char *memberInsPath(const char *archivePath, const char *memberName, const char *outDir)
+{
+    const char *slash = strrchr(archivePath, '/'), *base = strrchr(memberName, '/');
+    size_t dirLen = slash ? (size_t)(slash - archivePath + 1) : 0;
+    char *path, *insPath;
+
+    base = base ? base + 1 : memberName;
+    path = malloc(dirLen + strlen(base) + 1);
+    memcpy(path, archivePath, dirLen);
+    strcpy(path + dirLen, base);
+    insPath = batchInsPath(path, outDir);
+    free(path);
+    return insPath;
+}
+
+/* Archives opened for a run, kept open until every job reading from them is done */
+typedef struct
+{
+    Archive **list;
+    int n;
+} ArchiveSet;
+
+/* Replace the job of every archive among the inputs by one job per dump inside
+it, in archive order. Archives that can't be read are reported and dropped. */
+static BatchJob *expandArchives(BatchJob *jobs, int *nJobs, ArchiveSet *archives, const BatchOptions *options)
+{
+    BatchJob *expanded = 0, *job;
+    Archive *archive;
+    int i, m, n = 0, capacity = *nJobs ? *nJobs : 1;
+
+    archives->list = 0;
+    archives->n = 0;
+    expanded = malloc(capacity * sizeof(*expanded));
+
+    for (i = 0; i < *nJobs; i++)
+    {
+        if (!archiveIsArchive(jobs[i].syxPath))
+        {
+            expanded[n++] = jobs[i];
+            continue;
+        }
+
+        archive = malloc(sizeof(*archive));
+        if (!archiveOpen(archive, jobs[i].syxPath))
+        {
+            printf("\"%s\" is not a zip or tar archive.\n", jobs[i].syxPath);
+            free(archive);
+        }
+        else
+        {
+            archives->list = realloc(archives->list, (archives->n + 1) * sizeof(*archives->list));
+            archives->list[archives->n++] = archive;
+
+            for (m = 0; m < archive->nMembers; m++)
+            {
+                if (!isInputName(archive->members[m].name))
+                    continue;
+                if (n == capacity)
+                {
+                    capacity *= 2;
+                    expanded = realloc(expanded, capacity * sizeof(*expanded));
+                }
+                job = &expanded[n++];
+                memset(job, 0, sizeof(*job));
+                job->syxPath = malloc(strlen(archive->path) + strlen(archive->members[m].name) + 2);
+                sprintf(job->syxPath, "%s:%s", archive->path, archive->members[m].name);
+                job->insPath = options->combinedIns ? 0 : memberInsPath(archive->path, archive->members[m].name, options->outDir);
+                job->archive = archive;
+                job->member = m;
+            }
+        }
+        free(jobs[i].syxPath);
+        free(jobs[i].insPath);
+    }
+    free(jobs);
+    *nJobs = n;
+    return expanded;
+}
+
+static void closeArchives(ArchiveSet *archives)
+{
+    int i;
+
+    for (i = 0; i < archives->n; i++)
+    {
+        archiveClose(archives->list[i]);
+        free(archives->list[i]);
+    }
+    free(archives->list);
+}
+
+static void freeJobs(BatchJob *jobs, int nJobs)
+{
+    int i;
+
+    for (i = 0; i < nJobs; i++)
+    {
+        free(jobs[i].syxPath);
+        free(jobs[i].insPath);
+    }
+    free(jobs);
+}
+
+static int runBatch(const char *input, const BatchOptions *options)
+{
+    const char *combinedIns = options->combinedIns;
+    ConversionCache cache, *useCache = 0;
+    ArchiveSet archives;
+    char optionsKey[64];
+    char **paths;
+    int nJobs;
+    struct stat info;
+    BatchJob *jobs;
+    ConversionMetrics total;
+    double started = metricsNow(), emitStarted;
+    int i, nFailed = 0, nCached = 0, nUnchanged = 0, unchanged;
+
+    /* A library may be written to while a batch runs over it, see setCopyInputs() */
+    setCopyInputs(1);
+    if (!collectInputs(input, &paths, &nJobs))
+        return 1;
+
+    /* Without a cache nothing gets overwritten. With one, a rebuild replaces it at the end. */
+    if (combinedIns && !options->cacheDir && !mergeOutput && stat(combinedIns, &info) == 0)
+    {
+        printf("\nFile \"%s\" already exists.\nAborting...\n", combinedIns);
+        return 1;
+    }
+
+    if (options->cacheDir)
+    {
+        cacheOptionsKey(optionsKey);
+        if (!cacheOpen(&cache, options->cacheDir, optionsKey))
+        {
+            printf("Can't use \"%s\" as cache directory.\n", options->cacheDir);
+            return 1;
+        }
+        useCache = &cache;
+    }
+
+    jobs = createJobs(paths, nJobs, options);
+    free(paths);
+    jobs = expandArchives(jobs, &nJobs, &archives, options);
+    if (!options->combinedIns)
+        makeUniqueInsPaths(jobs, nJobs);
+    if (nJobs == 0)
+    {
+        printf("No input files found in \"%s\".\n", input);
+        free(jobs);
+        closeArchives(&archives);
+        if (useCache)
+            cacheClose(useCache);
+        return 1;
+    }
+    runJobs(jobs, nJobs, options->nWorkers, useCache, useCache != 0, options->log);
+
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < nJobs; i++)
+    {
+        metricsAdd(&total, &jobs[i].metrics);
+        if (jobs[i].status != JOB_OK)
+        {
+            printf("%s: %s\n", jobs[i].syxPath, statusText[jobs[i].status]);
+            nFailed++;
+        }
+        nCached += jobs[i].fromCache;
+        nUnchanged += jobs[i].unchanged;
+    }
+
+    if (combinedIns && nFailed < nJobs)
+    {
+        emitStarted = metricsNow();
+        if (!writeCombinedIns(jobs, nJobs, combinedIns, useCache, useCache != 0, options->dedupe, &unchanged))
+            nFailed = nJobs;
+        nUnchanged += unchanged;
+        total.emitSeconds += metricsNow() - emitStarted;
+    }
+
+    if (options->indexFile && !updateTimbreIndex(jobs, nJobs, options->indexFile))
+        nFailed = nJobs;
+
+    printf("\n%d of %d files converted.\n", nJobs - nFailed, nJobs);
+    if (useCache)
+    {
+        printf("%d taken from the cache, %d INS files already up to date.\n", nCached, nUnchanged);
+        cacheClose(useCache);
+    }
+
+    if (options->metricsFile && !metricsWriteJson(options->metricsFile, &total, metricsNow() - started))
+        printf("Can't write \"%s\".\n", options->metricsFile);
+
+    freeJobs(jobs, nJobs);
+    closeArchives(&archives);
+
+    return nFailed ? 1 : 0;
+}
+
+/* ********************************************************************* */
+/* Watch mode: convert everything once, then keep the tables loaded and redo only
+the dumps that change. Linux only, it sits on inotify. */
+
+#ifdef __linux__
+
+#define WATCH_DEBOUNCE_MS   25      //Quiet time after the last write before converting
+
+/* One watched directory. The same directory can be listed under several
+prefixes when a list file spells its path differently. */
+typedef struct
+{
+    int wd;
+    char *prefix;                   //"" or "dir/", put in front of event names to get a job path
+} WatchedDir;
+
+typedef struct
+{
+    int fd;
+    WatchedDir *dirs;
+    int nDirs, capacity;
+} Watcher;
+
+static void watchDirectory(Watcher *watcher, const char *dirName, const char *prefix)
+{
+    int wd = inotify_add_watch(watcher->fd, dirName, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+    int i;
+
+    if (wd < 0)
+        return;
+    for (i = 0; i < watcher->nDirs; i++)
+        if (watcher->dirs[i].wd == wd && !strcmp(watcher->dirs[i].prefix, prefix))
+            return;
+
+    if (watcher->nDirs == watcher->capacity)
+    {
+        watcher->capacity = watcher->capacity ? watcher->capacity * 2 : 16;
+        watcher->dirs = realloc(watcher->dirs, watcher->capacity * sizeof(*watcher->dirs));
+    }
+    watcher->dirs[watcher->nDirs].wd = wd;
+    watcher->dirs[watcher->nDirs].prefix = strdup(prefix);
+    watcher->nDirs++;
+}
+
+/* Watch a directory and everything below it, paths built the same way collectDirectory() does */
+static void watchTree(Watcher *watcher, const char *dirName)
+{
+    DIR *dir = opendir(dirName);
+    struct dirent *entry;
+    struct stat info;
+    char *path;
+
+    path = malloc(strlen(dirName) + 2);
+    sprintf(path, "%s/", dirName);
+    watchDirectory(watcher, dirName, path);
+    free(path);
+
+    if (!dir)
+        return;
+    while ((entry = readdir(dir)) != 0)
+    {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+
+        path = malloc(strlen(dirName) + strlen(entry->d_name) + 2);
+        sprintf(path, "%s/%s", dirName, entry->d_name);
+        if (stat(path, &info) == 0 && S_ISDIR(info.st_mode))
+            watchTree(watcher, path);
+        free(path);
+    }
+    closedir(dir);
+}
+
+/* Watch the directory each listed file lives in */
+static void watchListedFiles(Watcher *watcher, const BatchJob *jobs, int nJobs)
+{
+    const char *slash;
+    char *prefix;
+    int i;
+
+    for (i = 0; i < nJobs; i++)
+    {
+        if (jobs[i].archive)
+            continue;
+        slash = strrchr(jobs[i].syxPath, '/');
+        prefix = strdup(jobs[i].syxPath);
+        prefix[slash ? slash - jobs[i].syxPath + 1 : 0] = 0;
+        watchDirectory(watcher, prefix[0] ? prefix : ".", prefix);
+        free(prefix);
+    }
+}
+
+static double elapsedMs(const struct timespec *since)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000.0 + (now.tv_nsec - since->tv_nsec) / 1000000.0;
+}
+
+/* Mark the job for path as changed. In directory mode a new input file becomes a
+new job, returns the (possibly moved) job array. */
+static BatchJob *markChanged(BatchJob *jobs, int *nJobs, unsigned char **dirty, const char *path, int addNew, const BatchOptions *options)
+{
+    char *newPath, *plain;
+    int i, n;
+
+    for (i = 0; i < *nJobs; i++)
+    {
+        if (!strcmp(jobs[i].syxPath, path))
+        {
+            (*dirty)[i] = 1;
+            return jobs;
+        }
+    }
+    if (!addNew || !isInputName(path))
+        return jobs;
+
+    newPath = strdup(path);
+    jobs = realloc(jobs, (*nJobs + 1) * sizeof(*jobs));
+    *dirty = realloc(*dirty, *nJobs + 1);
+    memset(&jobs[*nJobs], 0, sizeof(*jobs));
+    jobs[*nJobs].syxPath = newPath;
+    jobs[*nJobs].insPath = options->combinedIns ? 0 : batchInsPath(newPath, options->outDir);
+    plain = jobs[*nJobs].insPath;
+    for (n = 2, i = 0; plain && i < *nJobs; i++)
+    {
+        /* A new file can't take over the INS of one already being watched */
+        if (jobs[i].insPath && !strcmp(jobs[i].insPath, jobs[*nJobs].insPath))
+        {
+            if (jobs[*nJobs].insPath != plain)
+                free(jobs[*nJobs].insPath);
+            jobs[*nJobs].insPath = numberedInsPath(plain, n++);
+            i = -1;
+        }
+    }
+    if (plain && jobs[*nJobs].insPath != plain)
+        free(plain);
+    (*dirty)[*nJobs] = 1;
+    (*nJobs)++;
+    return jobs;
+}
+
+static int runWatch(const char *input, const BatchOptions *options)
+{
+    ConversionCache cache, *useCache = 0;
+    ArchiveSet archives;
+    char optionsKey[64];
+    Syx2InsState *state = malloc(sizeof(*state));
+    Watcher watcher = { -1, 0, 0, 0 };
+    char events[16384];
+    const struct inotify_event *event;
+    struct pollfd poller;
+    struct timespec started;
+    unsigned char *dirty;
+    char **paths, *path;
+    BatchJob *jobs;
+    struct stat info;
+    int nJobs, i, nChanged, dirMode, unchanged;
+    ssize_t got, pos;
+
+    if (!collectInputs(input, &paths, &nJobs))
+        return 1;
+    dirMode = stat(input, &info) == 0 && S_ISDIR(info.st_mode);
+
+    if (options->cacheDir)
+    {
+        cacheOptionsKey(optionsKey);
+        if (!cacheOpen(&cache, options->cacheDir, optionsKey))
+        {
+            printf("Can't use \"%s\" as cache directory.\n", options->cacheDir);
+            return 1;
+        }
+        useCache = &cache;
+    }
+
+    watcher.fd = inotify_init1(IN_CLOEXEC);
+    if (watcher.fd < 0)
+    {
+        printf("Can't watch for changes (inotify unavailable).\n");
+        return 1;
+    }
+
+    /* Everything watch mode converts is being saved right then, see setCopyInputs() */
+    setCopyInputs(1);
+
+    /* Watch first so nothing saved during the initial conversion gets missed.
+    Dumps inside archives are converted once, only plain files are watched. */
+    jobs = createJobs(paths, nJobs, options);
+    free(paths);
+    jobs = expandArchives(jobs, &nJobs, &archives, options);
+    if (!options->combinedIns)
+        makeUniqueInsPaths(jobs, nJobs);
+    if (dirMode)
+        watchTree(&watcher, input);
+    else
+        watchListedFiles(&watcher, jobs, nJobs);
+
+    /* The outputs belong to us while watching, so they are always replaced */
+    runJobs(jobs, nJobs, options->nWorkers, useCache, 1, options->log);
+    for (i = 0; i < nJobs; i++)
+        if (jobs[i].status != JOB_OK)
+            printf("%s: %s\n", jobs[i].syxPath, statusText[jobs[i].status]);
+    if (options->combinedIns)
+        writeCombinedIns(jobs, nJobs, options->combinedIns, useCache, 1, options->dedupe, &unchanged);
+
+    printf("\nWatching %d files for changes, press Ctrl+C to stop.\n", nJobs);
+    fflush(stdout);
+    logSinkFlush(options->log);
+
+    dirty = calloc(nJobs, 1);
+    poller.fd = watcher.fd;
+    poller.events = POLLIN;
+
+    for (;;)
+    {
+        /* Wait for the first write, then keep collecting until things have been
+        quiet for WATCH_DEBOUNCE_MS so a burst of saves is converted once */
+        if (poll(&poller, 1, -1) < 0 && errno != EINTR)
+            break;
+        clock_gettime(CLOCK_MONOTONIC, &started);
+
+        do
+        {
+            got = read(watcher.fd, events, sizeof(events));
+            for (pos = 0; pos < got; pos += sizeof(*event) + event->len)
+            {
+                event = (const struct inotify_event *)&events[pos];
+                if (!event->len)
+                    continue;
+
+                for (i = 0; i < watcher.nDirs; i++)
+                {
+                    if (watcher.dirs[i].wd != event->wd)
+                        continue;
+
+                    path = malloc(strlen(watcher.dirs[i].prefix) + event->len + 1);
+                    sprintf(path, "%s%s", watcher.dirs[i].prefix, event->name);
+                    if ((event->mask & IN_ISDIR) && dirMode)
+                        watchTree(&watcher, path);
+                    else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                        jobs = markChanged(jobs, &nJobs, &dirty, path, dirMode, options);
+                    free(path);
+                }
+            }
+        } while (poll(&poller, 1, WATCH_DEBOUNCE_MS) > 0);
+
+        for (i = 0, nChanged = 0; i < nJobs; i++)
+        {
+            if (!dirty[i])
+                continue;
+
+            dirty[i] = 0;
+            nChanged++;
+            runJob(&jobs[i], state, useCache, 1, options->log);
+            if (jobs[i].status != JOB_OK)
+                printf("%s: %s\n", jobs[i].syxPath, statusText[jobs[i].status]);
+            else if (jobs[i].insPath)
+                printf("%s -> %s\n", jobs[i].syxPath, jobs[i].insPath);
+        }
+        if (nChanged && options->combinedIns && writeCombinedIns(jobs, nJobs, options->combinedIns, useCache, 1, options->dedupe, &unchanged))
+            printf("%d changed, %s updated\n", nChanged, options->combinedIns);
+        if (nChanged)
+        {
+            printf("(%.1f ms)\n", elapsedMs(&started));
+            fflush(stdout);
+            logSinkFlush(options->log);
+        }
+    }
+
+    close(watcher.fd);
+    for (i = 0; i < watcher.nDirs; i++)
+        free(watcher.dirs[i].prefix);
+    free(watcher.dirs);
+    freeJobs(jobs, nJobs);
+    closeArchives(&archives);
+    free(dirty);
+    free(state);
+    if (useCache)
+        cacheClose(useCache);
+    return 1;
+}
+
+#else
+
+static int runWatch(const char *input, const BatchOptions *options)
+{
+    (void)input;
+    (void)options;
+    printf("Watch mode needs inotify and is only available on Linux.\n");
+    return 1;
+}
+
+#endif
+
+/* List where else each custom timbre of a dump turns up in the index, and the
+closest named timbre of another file as a suggestion for what it is */
+static int runLookup(const char *indexFile, const char *syxPath)
+{
+    TimbreIndex index;
+    InputFile input;
+    Syx2InsState *state;
+    Syx2InsResult result;
+    const TimbreRecord *records, *nearest;
+    uint32_t f, self = UINT32_MAX;
+    unsigned distance;
+    size_t n, r;
+    int i, status, nShared = 0;
+
+    if (!timbreIndexOpen(&index, indexFile))
+    {
+        printf("\"%s\" is not a timbre index.\n", indexFile);
+        return 1;
+    }
+    if (!openInput(syxPath, &input))
+    {
+        printf("File \"%s\" does not exist.\n", syxPath);
+        timbreIndexClose(&index);
+        return 1;
+    }
+
+    state = malloc(sizeof(*state));
+    status = containerConvert(input.data, input.size, state, &result);
+    free(state);
+    closeInput(&input);
+    if (status != SYX2INS_OK)
+    {
+        printf("\"%s\" is not a valid MT-32 SysEx file.\n", syxPath);
+        timbreIndexClose(&index);
+        return 1;
+    }
+
+    for (f = 0; f < index.header->nFiles; f++)
+        if (!strcmp(timbreIndexFile(&index, f), syxPath))
+            self = f;
+
+    for (i = 0; i < 64; i++)
+    {
+        if (!result.timbreWritten[i])
+            continue;
+
+        printf("M%02d %-10s", i + 1, result.timbreNames[i]);
+        if (timbreIndexNearest(&index, result.timbreFeatures[i], self, TIMBRE_SIMILAR_DISTANCE, &nearest, &distance))
+            printf("  closest: %.10s (%s M%02d, distance %u)", nearest->name, timbreIndexFile(&index, nearest->file), nearest->slot + 1, distance);
+        n = timbreIndexFind(&index, result.timbreHash[i], &records);
+        for (r = 0; r < n; r++)
+        {
+            /* Don't report the dump as sharing a timbre with itself */
+            if (!strcmp(timbreIndexFile(&index, records[r].file), syxPath) && records[r].slot == i)
+                continue;
+            printf("\n    %s  M%02d %.10s", timbreIndexFile(&index, records[r].file), records[r].slot + 1, records[r].name);
+            nShared++;
+        }
+        printf("\n");
+    }
+    printf("\n%d matches.\n", nShared);
+
+    timbreIndexClose(&index);
+    return 0;
+}
+
+/* Threads a big capture is framed on in single mode, one per core */
+static int defaultThreadCount(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int)n : 1;
+}
+
+/* Write the INS to the file single mode just created, or merge it into the
+existing one, and any other formats asked for next to it. Those never replace
+an existing file. Returns 0 if any of them couldn't be written. */
+static int writeSingleOutput(FILE *insFile, int merge, const char *insPath, const Syx2InsResult *banks, int nBanks)
+{
+    OutputBuffer out;
+    struct stat info;
+    char *path;
+    int f, ok;
+
+    ok = (merge || insFile) && emitRender(FORMAT_INS, banks, nBanks, &out);
+    if (ok)
+    {
+        if (merge)
+            ok = insMergeFile(insPath, out.data, out.size);
+        else
+            ok = emitWrite(fileno(insFile), &out);
+        emitFree(&out);
+    }
+    if (insFile && fclose(insFile))
+        ok = 0;
+    if (!ok)
+        printf("Can't write \"%s\".\n", insPath);
+
+    for (f = 0; f < NUM_FORMATS; f++)
+    {
+        if (f == FORMAT_INS || !(outputFormats & FORMAT_MASK(f)))
+            continue;
+
+        path = emitPath(insPath, f);
+        if (stat(path, &info) == 0)
+            printf("File \"%s\" already exists, not writing it.\n", path);
+        else if (!emitRender(f, banks, nBanks, &out))
+        {
+            printf("Can't write \"%s\".\n", path);
+            ok = 0;
+        }
+        else
+        {
+            if (!writeFileAtomic(path, out.data, out.size))
+            {
+                printf("Can't write \"%s\".\n", path);
+                ok = 0;
+            }
+            emitFree(&out);
+        }
+        free(path);
+    }
+    return ok;
+}
+
+/* Convert one SYX file into one INS, the way the tool always has. Progress goes
+to the console, the details to the log, which the caller flushes in one write. */
+static void runSingle(const char *syxName, const char *insName, Logger *log, ConversionMetrics *metrics)
+{
+    Syx2InsResult bank, *uploads = 0;
+    int nUploads = 0, parsed;
+    char *dot;                      //Pointer for handling existence and absence of file extensions in the program
+    double start = metricsNow(), now;
+
+    /* We assume syxName is a filename to open ("-" reads the dump from stdin).
+    Regular files are mapped and parsed in place rather than copied. */
+    InputFile input;
+    int opened = openInput( syxName, &input );
+
+    /* Input and output names with an extension added, freed on the way out */
+    char *syxExt = 0, *insExt = 0;
+    int filenameLen;
+
+    metrics->files = 1;
+    metrics->failed = 1;
+
+    dot = strrchr(syxName, '.');
+
+    if(!dot && !opened) /* check for file extension in argument */
+    {
+        //printf("No extension found in first argument and file does not exist.\nAdding SYX extension...\n");
+        logPrint(log, LOG_TRACE, "No extension found in first argument and file does not exist.\nAdding SYX extension...\n");
+
+        filenameLen = strlen(syxName);
+        syxExt = malloc(filenameLen+5);
+        memcpy(syxExt, syxName, filenameLen);
+        strcpy(syxExt + filenameLen, ".SYX");
+
+        if ( !openInput( syxExt, &input ) )
+        {
+            printf("Failed.\n\nFile \"%s\" does not exist.\n", syxExt );
+            logPrint(log, LOG_SUMMARY, "Failed.\n\nFile \"%s\" does not exist.\n", syxExt);
+            goto out;
+        }
+        //printf("Success! \"%s\" file found!\n\n", syxExt);
+        logPrint(log, LOG_TRACE, "Success! \"%s\" file found!\n\n", syxExt);
+    }
+    else if( !opened )
+    {
+        printf("File \"%s\" does not exist.\n", syxName);
+        logPrint(log, LOG_SUMMARY, "File \"%s\" does not exist.\n", syxName);
+        goto out;
+    }
+
+    /* Successful file open, whether it had a dot or not, one was added */
+    const unsigned char *buffer = input.data;
+    unsigned long fsize = input.size;
+
+    now = metricsNow();
+    metrics->loadSeconds = now - start;
+    start = now;
+    metrics->bytesScanned = fsize;
+
+    /* Walk the whole file once. Each message is framed and its DT1 header decoded
+    a single time, then the payload goes into the emulated MT-32 memory. Big
+    captures are framed on several threads first, MIDI files and SCI patch
+    resources are unpacked on the fly. */
+    ContainerKind kind = containerDetect(buffer, fsize);
+    Syx2InsState state;
+    syx2insReset(&state);
+
+    /* Splitting frames the whole capture, so when it finds nothing there is no
+    point in parsing it again. It only fails if memory runs out. */
+    if (kind == CONTAINER_SYX && splitUploads && captureUploads(&state, buffer, fsize, defaultThreadCount(), &uploads, &nUploads))
+        parsed = nUploads > 0;
+    else
+        parsed = containerParse(kind, &state, buffer, fsize, defaultThreadCount());
+
+    /* Start searching for Roland send SysEx Command */
+    if( !parsed )
+    {
+        /* File exists, but no point in continuing since there is no MT-32 sysex in it */
+        printf( "Not a valid MT-32 SysEx file.\nAborting...\n" );
+        logPrint(log, LOG_SUMMARY, "No MT-32 sysex found in %s. Not a valid MT-32 SysEx file.\nAborting...\n", containerNames[kind] );
+    }
+    else
+    {
+        if (kind == CONTAINER_SYX)
+        {
+            printf( "MT-32 sysex header found!\n" );
+            logPrint(log, LOG_SUMMARY, "MT-32 sysex header found!\n" );
+        }
+        else
+        {
+            printf( "MT-32 sysex found in %s!\n", containerNames[kind] );
+            logPrint(log, LOG_SUMMARY, "MT-32 sysex found in %s!\n", containerNames[kind] );
+        }
+
+        printf("Cataloging custom timbre names...\n");
+        logPrint(log, LOG_TRACE, "Cataloging custom timbre names...\n");
+
+        metrics->messagesFramed = state.nMessages;
+        now = metricsNow();
+        metrics->parseSeconds = now - start;
+        start = now;
+
+        syx2insResolve(&state, &bank);
+
+        /* If the MT-32's 'write to dispay' command (20 00 00) gave us a title we use
+        it for naming the patch list in the INS output file, otherwise we generate the
+        title based on filename instead. */
+        if ( bank.haveTitle )
+        {
+            logPrint(log, LOG_TRACE, "Custom title text found! Generating list title name...\n");
+            if (state.display[0] == 0x20)
+                logPrint(log, LOG_TRACE, "Preceding spaces found in title. Removing...\n");
+        }
+        else
+        {
+            //printf("No custom title text found.\nGenerating list title after filename instead...\n\n");
+            logPrint(log, LOG_TRACE, "No custom title text found.\nGenerating list title after filename instead...\n\n");
+            syx2insTitleFromPath(syxName, bank.title);
+        }
+
+        logPrint(log, LOG_SUMMARY, "\[%s]\n\n", bank.title );
+        countResolved(metrics, &bank);
+
+        /* Damaged messages were left out, the rest of the dump still counts */
+        if (bank.diagnostics.total)
+        {
+            printf("%lu damaged messages found, see the log.\n", bank.diagnostics.total);
+            logDiagnostics(log, syxName, &bank.diagnostics);
+            logPrint(log, LOG_SUMMARY, "\n");
+        }
+
+        /* With one bank per upload, those without display text are named after the
+        file and numbered */
+        if (uploads)
+        {
+            int u;
+            for (u = 0; u < nUploads; u++)
+                if (!uploads[u].haveTitle)
+                    syx2insTitleFromPath(syxName, uploads[u].title);
+            makeUniqueTitles(uploads, nUploads);
+            printf("%d uploads found.\n", nUploads);
+            logPrint(log, LOG_SUMMARY, "%d uploads found.\n\n", nUploads);
+        }
+        now = metricsNow();
+        metrics->resolveSeconds = now - start;
+        start = now;
+
+        /* ********************************************************************* */
+        /* Prepare timbre and patch names for INS file */
+
+        FILE *insFile;
+        const char *insPath = insName;
+        int merge = 0, written;
+
+        dot = strrchr(insName, '.');
+
+        if(!dot) /* If there's no extension given, create it automatically */
+        {
+            //printf("No extension given for output INS file.\nAdding...\n\n");
+            logPrint(log, LOG_TRACE, "No extension given for output INS file.\nAdding .INS extension...\n");
+
+            filenameLen = strlen(insName);
+            insExt = malloc(filenameLen+5);
+            memcpy(insExt, insName, filenameLen);
+            strcpy(insExt + filenameLen, ".INS");
+            insFile = fopen(insExt, "r");
+            if(insFile != 0 && mergeOutput)
+            {
+                fclose(insFile);
+                insFile = 0;
+                merge = 1;
+                logPrint(log, LOG_TRACE, "\"%s\" already exists, merging into it...\n", insExt);
+            }
+            else if(insFile != 0)
+            {
+                printf("\nFile \"%s.INS\" already exists.\nAborting...\n", insName);
+                logPrint(log, LOG_SUMMARY, "\nFile \"%s.INS\" already exists.\nAborting...", insName);
+                fclose(insFile);
+                goto out;
+            }
+            else
+                insFile = fopen(insExt, "w");
+            insPath = insExt;
+        }
+        else
+        {
+            //printf("Extension given. Continuing normally...\n");
+
+            insFile = fopen(insName, "r");
+            if(insFile != 0 && mergeOutput)
+            {
+                fclose(insFile);
+                insFile = 0;
+                merge = 1;
+                logPrint(log, LOG_TRACE, "\"%s\" already exists, merging into it...\n", insName);
+            }
+            else if(insFile != 0)
+            {
+                printf("\nFile \"%s\" already exists.\nAborting...\n", insName);
+                logPrint(log, LOG_SUMMARY, "\nFile \"%s\" already exists.\nAborting...", insName);
+                fclose(insFile);
+                goto out;
+            }
+            else
+                insFile = fopen(insName, "w");
+        }
+
+        printf("Generating final instrument list...\n\n");
+        logPrint(log, LOG_TRACE, "Generating final instrument list...\n\n");
+
+        /* One dot per patch the dump set, printed in one go */
+        char dots[129];
+        int i, nDots = 0;
+        for (i = 0; i < 128; i++)
+        {
+            if (bank.patchWritten[i])
+            {
+                logPrint(log, LOG_TRACE, "%s\n", bank.patchNames[i]);
+                dots[nDots++] = '.';
+            }
+        }
+        dots[nDots] = 0;
+        fputs(dots, stdout);
+
+        printf("\n\nGenerating INS file...\n\n");
+        logPrint(log, LOG_TRACE, "\nGenerating INS file...\n\n");
+
+        /* Begin generating INS file */
+        if (uploads)
+            written = writeSingleOutput(insFile, merge, insPath, uploads, nUploads);
+        else
+            written = writeSingleOutput(insFile, merge, insPath, &bank, 1);
+        metrics->emitSeconds = metricsNow() - start;
+        metrics->failed = !written;
+        if (!written)
+        {
+            logPrint(log, LOG_SUMMARY, "Can't write \"%s\".\n", insPath);
+            goto out;
+        }
+    }
+    printf("DONE!\n");
+    logPrint(log, LOG_SUMMARY, "DONE!\n");
+
+out:
+    /* Every way out of here goes through this. openInput() leaves input empty
+    when it fails, so closing it is always safe. */
+    free(uploads);
+    closeInput(&input);
+    free(syxExt);
+    free(insExt);
+}
+
+int main (int argc, char *argv[])
+{
+	float nVersion = 1.00;
+
+    LogLevel logLevel = LOG_TRACE;
+    const char *logPath = 0, *metricsFile = 0;
+    int haveLogLevel = 0, a, n;
+
+    printf( "Syx2Ins  v%.2f    by Brandon Blume, July 2015\n\n", nVersion );
+
+    /* Pick the message scanner for this CPU once, before any parsing */
+    syx2insInit();
+
+    /* Logging and format options work in every mode and can go anywhere, take them out first */
+    for (a = 1, n = 1; a < argc; a++)
+    {
+        if (a + 1 < argc && !strcmp(argv[a], "-log") && logParseLevel(argv[a+1], &logLevel))
+        {
+            haveLogLevel = 1;
+            a++;
+        }
+        else if (a + 1 < argc && !strcmp(argv[a], "-logfile"))
+            logPath = argv[++a];
+        else if (a + 1 < argc && !strcmp(argv[a], "-metrics"))
+            metricsFile = argv[++a];
+        else if (!strcmp(argv[a], "-uploads"))
+            splitUploads = 1;
+        else if (!strcmp(argv[a], "-merge"))
+            mergeOutput = 1;
+        else if (a + 1 < argc && !strcmp(argv[a], "-format"))
+        {
+            if (!emitParseFormats(argv[++a], &outputFormats))
+            {
+                printf("Unknown output format in \"%s\", use ins, json, csv or sci.\n", argv[a]);
+                return 1;
+            }
+        }
+        else
+            argv[n++] = argv[a];
+    }
+    argc = n;
+
+    if (argc >= 3 && (!strcmp(argv[1], "-batch") || !strcmp(argv[1], "-watch")))
+    {
+        BatchOptions options = { 0, 0, 0, 0, 0, defaultThreadCount(), 0, metricsFile };
+        LogSink sink;
+        int status;
+
+        for (a = 3; a < argc; a += 2)
+        {
+            if (!strcmp(argv[a], "-dedupe"))
+            {
+                options.dedupe = 1;
+                a--;
+            }
+            else if (a + 1 == argc)
+                break;
+            else if (!strcmp(argv[a], "-o"))
+                options.outDir = argv[a+1];
+            else if (!strcmp(argv[a], "-combine"))
+                options.combinedIns = argv[a+1];
+            else if (!strcmp(argv[a], "-cache"))
+                options.cacheDir = argv[a+1];
+            else if (!strcmp(argv[a], "-index"))
+                options.indexFile = argv[a+1];
+            else if (!strcmp(argv[a], "-j") && atoi(argv[a+1]) > 0)
+                options.nWorkers = atoi(argv[a+1]);
+            else
+                break;
+        }
+        if (a == argc)
+        {
+            /* Batch and watch mode only log when asked to, to stdout unless -logfile says otherwise */
+            if (!logSinkOpen(&sink, logPath ? logPath : "-", haveLogLevel ? logLevel : LOG_OFF))
+            {
+                printf("Can't write \"%s\".\n", logPath);
+                return 1;
+            }
+            options.log = &sink;
+            status = !strcmp(argv[1], "-watch") ? runWatch(argv[2], &options) : runBatch(argv[2], &options);
+            logSinkClose(&sink);
+            return status;
+        }
+    }
+
+    if (argc == 4 && !strcmp(argv[1], "-lookup"))
+        return runLookup(argv[2], argv[3]);
+
+    /* An archive holds many dumps, converting it on its own gives one INS with a bank for each */
+    if (argc == 3 && archiveIsArchive(argv[1]))
+    {
+        BatchOptions options = { 0, argv[2], 0, 0, 0, defaultThreadCount(), 0, metricsFile };
+        LogSink sink;
+        int status;
+
+        if (!logSinkOpen(&sink, logPath ? logPath : "-", haveLogLevel ? logLevel : LOG_OFF))
+        {
+            printf("Can't write \"%s\".\n", logPath);
+            return 1;
+        }
+        options.log = &sink;
+        status = runBatch(argv[1], &options);
+        logSinkClose(&sink);
+        return status;
+    }
+
+    if (argc != 3) /* argc should be 3 for correct execution */
+    {
+        /* We print argv[0] assuming it is the program name */
+        printf( "usage:  %s  [-uploads]  syxfile  insfile\n", argv[0] );
+        printf( "        %s  archive  insfile\n", argv[0] );
+        printf( "        %s  -batch  directory|listfile  [-o outdir | -combine insfile [-dedupe]]  [-cache dir]  [-index file]  [-j threads]\n", argv[0] );
+        printf( "        %s  -watch  directory|listfile  [-o outdir | -combine insfile [-dedupe]]  [-cache dir]  [-j threads]\n", argv[0] );
+        printf( "        %s  -lookup  indexfile  syxfile\n", argv[0] );
+        printf( "options for every mode:  [-format ins,json,csv,sci]  [-merge]  [-log off|summary|trace]  [-logfile file]  [-metrics jsonfile]\n" );
+        return 0;
+    }
+    else
+    {
+        LogSink sink;
+        Logger log;
+        ConversionMetrics metrics;
+        double started = metricsNow();
+
+        /* Set up log file, log.txt at full detail unless told otherwise */
+        if (!logSinkOpen(&sink, logPath ? logPath : "log.txt", logLevel))
+        {
+            printf("Can't write \"%s\".\n", logPath ? logPath : "log.txt");
+            return 1;
+        }
+        loggerBegin(&log, &sink);
+        logPrint(&log, LOG_SUMMARY, "Syx2Ins v%.2f  Log File    by Brandon Blume, July 2015\n======================\nInput file: \"%s\"\n\n", nVersion, argv[1]);
+
+        memset(&metrics, 0, sizeof(metrics));
+        runSingle(argv[1], argv[2], &log, &metrics);
+
+        loggerEnd(&log);
+        logSinkClose(&sink);
+
+        if (metricsFile && !metricsWriteJson(metricsFile, &metrics, metricsNow() - started))
+            printf("Can't write \"%s\".\n", metricsFile);
+    }
+    return 0;
+}
@@ -0,0 +1,207 @@
+/********************************************************************************
+*	SYX2INS conversion library						*
+*									*
+*	Turns an MT-32 SYX dump held in memory into the patch list that	*
+*	the command line tool writes out as an INS file. Nothing in here	*
+*	allocates memory or touches files: the caller passes in the bytes	*
+*	and owns the state and result structures, so it can be called	*
+*	in-process as often as needed. syx2ins.c is the command line tool	*
+*	built on top of it.							*
+********************************************************************************/
+#ifndef SYX2INS_H
+#define SYX2INS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SYX2INS_VERSION     1.00
+
+/* Bump whenever parsing or syx2insResolve() can give a different result for the
+same input, so cached results of older builds aren't used any more */
+#define SYX2INS_RESULT_SCHEMA   6
+
+/* Addresses are sent as three 7 bit bytes, this gives the linear address */
+#define SYX2INS_ADDRESS(a, b, c)    (((unsigned long)(a) << 14) | ((unsigned long)(b) << 7) | (unsigned long)(c))
+
+/* Rhythm setup keys 24-108. The MT-32 only has 24-87, the CM-32L and CM-64 the rest as well. */
+#define SYX2INS_RHYTHM_KEYS 85
+
+/* Timbre parameters after the name: 4 common ones and 58 for each of the four partials */
+#define SYX2INS_TIMBRE_FEATURES 236
+
+/* Return values of syx2insConvert() */
+#define SYX2INS_OK          0
+#define SYX2INS_NOT_MT32    1       //Doesn't start with an MT-32 DT1 message
+
+/* What was wrong with an MT-32 message. Damaged messages are left out and the
+rest of the dump is still converted. */
+typedef enum
+{
+    SYX2INS_MESSAGE_OK,
+    SYX2INS_TRUNCATED,              //Cut short by another status byte or the end of the data, skipped
+    SYX2INS_BAD_CHECKSUM,           //Roland checksum doesn't match, skipped
+    SYX2INS_OUT_OF_RANGE,           //Runs past the end of the memory area it starts in, written up to there
+    SYX2INS_NUM_PROBLEMS
+} Syx2InsProblem;
+
+/* One damaged message */
+typedef struct
+{
+    size_t offset;                  //Position of the F0 byte in the data handed to the parser
+    size_t length;                  //Bytes the message covers
+    unsigned long address;          //Linear MT-32 address, 0 if the message ends before it
+    int problem;                    //Syx2InsProblem
+} Syx2InsDiagnostic;
+
+/* Only the first few damaged messages are kept in detail, all are counted */
+#define SYX2INS_MAX_DIAGNOSTICS 16
+
+typedef struct
+{
+    unsigned long counts[SYX2INS_NUM_PROBLEMS];    //Damaged messages of each kind, counts[0] unused
+    unsigned long total;
+    Syx2InsDiagnostic first[SYX2INS_MAX_DIAGNOSTICS];
+} Syx2InsDiagnostics;
+
+/* The parts of the MT-32's memory a dump can write to that matter for the INS.
+Every DT1 message is copied into here at its address, so the patch list comes
+from whatever the unit would hold after receiving the whole file, no matter how
+the dump splits or orders its messages. */
+typedef struct
+{
+    unsigned char rhythmSetup[SYX2INS_RHYTHM_KEYS][4];  //03 01 10: keys 24-108, timbre/level/pan/reverb
+    unsigned char patchMemory[128][8];      //05 00 00: group, timbre, key shift, fine tune, bender, assign, reverb, dummy
+    unsigned char timbreMemory[64][256];    //08 00 00: 246 byte timbres on 256 byte boundaries, name first
+    unsigned char systemArea[23];           //10 00 00
+    /* One flag per entry above, set once any byte of that entry was written */
+    unsigned char rhythmWritten[SYX2INS_RHYTHM_KEYS];
+    unsigned char patchWritten[128];
+    unsigned char timbreWritten[64];
+    unsigned char systemWritten[1];
+} MT32Memory;
+
+/* Parser state for one dump. Set it up with syx2insReset(), then feed it any
+number of spans of complete messages with syx2insParse(). A changed message can
+be applied on its own later without parsing the rest of the file again. */
+typedef struct
+{
+    unsigned char display[20];      //First 'write to display' text (20 00 00)
+    int haveDisplay;
+    MT32Memory memory;
+    unsigned long nMessages;        //MT-32 DT1 messages (or writes) applied so far
+    int wroteCM32P;                 //Something was sent to the CM-32P part (50 00 00 and up)
+    Syx2InsDiagnostics diagnostics;
+} Syx2InsState;
+
+/* Roland LA modules that take MT-32 dumps. They all answer to the same model
+ID, what sets them apart is the memory a dump uses: the CM-32L adds 33 sound
+effect rhythm timbres and rhythm keys 88-108, the CM-64 is a CM-32L with a
+CM-32P PCM part. */
+typedef enum
+{
+    SYX2INS_MT32,
+    SYX2INS_CM32L,
+    SYX2INS_CM64,
+    SYX2INS_NUM_DEVICES
+} Syx2InsDeviceId;
+
+typedef struct
+{
+    const char *name;
+    int nRhythmKeys;                        //Rhythm setup keys from 24 on
+    int nRhythmTimbres;                     //Rhythm timbres r01 on, rhythm setup timbre 64 + n is r(n+1)
+    const char (*patchNames)[11];           //The 128 preset patches, Group A then Group B
+    const char (*rhythmTimbreNames)[11];
+} Syx2InsDevice;
+
+/* Device profiles, indexed by Syx2InsDeviceId. Static data, nothing to set up. */
+extern const Syx2InsDevice syx2insDevices[SYX2INS_NUM_DEVICES];
+
+/* The converted patch bank */
+typedef struct
+{
+    char title[21];                 //Display text without leading spaces, empty if the dump has none
+    int haveTitle;
+    char patchNames[128][11];
+    unsigned char patchWritten[128];        //Patch was set by the dump rather than left at its default
+    char timbreNames[64][11];               //Custom timbre (Memory group) names
+    unsigned char timbreWritten[64];
+    uint64_t timbreHash[64];                //Hash of each timbre's parameters, name left out
+    unsigned char timbreFeatures[64][SYX2INS_TIMBRE_FEATURES];  //Each parameter scaled to 0-255, muted partials 0, for finding similar timbres
+    uint64_t soundHash;                     //Hash of what the 128 patches play, equal for dumps that only differ in names
+    unsigned char rhythmSetup[SYX2INS_RHYTHM_KEYS][4];  //Keys 24-108: timbre, output level, panpot, reverb switch
+    unsigned char rhythmWritten[SYX2INS_RHYTHM_KEYS];
+    char rhythmNames[SYX2INS_RHYTHM_KEYS][11];  //What each key plays, empty if it's off or the device has no such key
+    int device;                             //Syx2InsDeviceId the dump was made for
+    Syx2InsDiagnostics diagnostics;         //Damaged messages found on the way
+} Syx2InsResult;
+
+/* Pick the fastest message scanner the CPU supports. Call once before converting
+anything. Returns the name of the scanner in use. */
+const char *syx2insInit(void);
+
+/* Nonzero if the data starts with a Roland MT-32 DT1 message */
+int syx2insIsMT32(const unsigned char *data, size_t size);
+
+/* Bring the state back to a freshly powered on MT-32 */
+void syx2insReset(Syx2InsState *state);
+
+/* Apply every MT-32 DT1 message found in data to the state. Checksums and lengths
+are checked while framing; damaged messages are recorded in the state's
+diagnostics instead of being applied. */
+void syx2insParse(Syx2InsState *state, const unsigned char *data, size_t size);
+
+/* Apply one write to the state as if a DT1 message had carried it: size bytes
+of data at a linear address (SYX2INS_ADDRESS). For containers that hold memory
+images rather than messages, like Sierra's patch resources. */
+void syx2insWrite(Syx2InsState *state, unsigned long address, const unsigned char *data, size_t size);
+
+/* Frame the MT-32 DT1 messages in data without applying them and return how many
+intact ones there are. syx2insParse() does the same framing and checking, this is
+its cost on its own. */
+unsigned long syx2insCountMessages(const unsigned char *data, size_t size);
+
+/* Where one framed MT-32 DT1 message sits in a buffer */
+typedef struct
+{
+    size_t offset;                  //Position of the F0 byte
+    size_t length;                  //Whole message including F0 and F7
+    unsigned long address;          //Linear MT-32 address, (a1 << 14) | (a2 << 7) | a3
+    int problem;                    //Syx2InsProblem, damaged messages are framed too so they can be reported
+} Syx2InsMessage;
+
+/* Frame the messages that start in [from, to), reading past to where a message
+runs over the end. A message can't contain another F0, so framing gives the same
+messages no matter where it starts, and adjacent ranges can be framed separately
+(in parallel) and put back together in order. At most max messages are stored,
+*next is where to carry on if that wasn't all of them. Returns the count. */
+size_t syx2insFrameRange(const unsigned char *data, size_t size, size_t from, size_t to, Syx2InsMessage *messages, size_t max, size_t *next);
+
+/* Apply framed messages to the state in the order given, recording the damaged
+ones. Going through the messages of syx2insFrameRange() in file order gives the
+same state as syx2insParse() on the whole buffer. */
+void syx2insApplyMessages(Syx2InsState *state, const unsigned char *data, const Syx2InsMessage *messages, size_t n);
+
+/* Build the patch, timbre and rhythm lists from the current state */
+void syx2insResolve(const Syx2InsState *state, Syx2InsResult *result);
+
+/* Reset, parse and resolve in one go. state is only used as scratch space. */
+int syx2insConvert(const unsigned char *data, size_t size, Syx2InsState *state, Syx2InsResult *result);
+
+/* 64 bit FNV-1a, seed with SYX2INS_HASH_SEED or a previous hash to continue it */
+#define SYX2INS_HASH_SEED   0xCBF29CE484222325ULL
+uint64_t syx2insHash(const void *data, size_t size, uint64_t seed);
+
+/* Make a list title out of a file path for dumps without display text: no
+directories or extension, at most 20 characters */
+void syx2insTitleFromPath(const char *path, char title[21]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,618 @@
+/********************************************************************************
+*	SYX2INS benchmark							*
+*									*
+*	Builds a synthetic corpus of MT-32 dumps from a fixed seed and	*
+*	times every stage of a conversion on it separately:		*
+*									*
+*	  load      open, map and read every file			*
+*	  frame     find the DT1 messages (syx2insCountMessages)	*
+*	  pframe    the same on every core (captureFrame)		*
+*	  extract   frame and write them into the memory image (Parse)	*
+*	  resolve   timbre, patch and rhythm lists (Resolve)		*
+*	  emit      INS text (emitRender)				*
+*									*
+*	Results are MB/s of dump data and ns per DT1 message. They can be	*
+*	saved as a baseline and later runs compared against it, any stage	*
+*	that got slower by more than the tolerance is reported and the	*
+*	program exits with 1.						*
+********************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "syx2ins.h"
+#include "fileio.h"
+#include "emit.h"
+#include "capture.h"
+
+#define NUM(a) (sizeof(a) / sizeof(*a))
+
+#define DEFAULT_SEED        20150711
+#define DEFAULT_TOLERANCE   10.0    //Percent a stage may slow down before it counts as a regression
+#define ROUNDS              5       //Each stage is timed this often, the fastest round counts
+
+/* ********************************************************************* */
+/* Corpus generation. Everything comes from one xorshift generator so a seed
+always gives byte for byte the same files. */
+
+static uint64_t randomState;
+
+static unsigned nextRandom(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return (unsigned)(randomState >> 32);
+}
+
+typedef struct
+{
+    unsigned char *data;
+    size_t size, capacity;
+} Buffer;
+
+static void put(Buffer *buffer, const void *data, size_t size)
+{
+    if (buffer->size + size > buffer->capacity)
+    {
+        while (buffer->size + size > buffer->capacity)
+            buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+/* One DT1 message to the MT-32 at a1 a2 a3, with the Roland checksum */
+static void putDT1(Buffer *buffer, int a1, int a2, int a3, const unsigned char *data, size_t size)
+{
+    unsigned char header[8] = { 0xF0, 0x41, 0x10, 0x16, 0x12 }, trailer[2];
+    unsigned sum = a1 + a2 + a3;
+    size_t i;
+
+    header[5] = a1;
+    header[6] = a2;
+    header[7] = a3;
+    for (i = 0; i < size; i++)
+        sum += data[i];
+    trailer[0] = (128 - (sum & 0x7F)) & 0x7F;
+    trailer[1] = 0xF7;
+
+    put(buffer, header, sizeof(header));
+    put(buffer, data, size);
+    put(buffer, trailer, sizeof(trailer));
+}
+
+static void randomData(unsigned char *data, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        data[i] = nextRandom() & 0x7F;
+}
+
+/* Stuff a MIDI logger picks up between dump messages: lots of F0 bytes, DT1
+prefixes that get cut off, other manufacturers' SysEx and channel messages */
+static void putJunk(Buffer *buffer, size_t size)
+{
+    static const unsigned char cutPrefix[] = { 0xF0, 0x41, 0x10, 0x16, 0x12, 0x05, 0x00 };
+    static const unsigned char yamaha[] = { 0xF0, 0x43, 0x10, 0x4C, 0x00, 0x00, 0x7E, 0x00, 0xF7 };
+    unsigned char byte;
+    size_t start = buffer->size;
+
+    while (buffer->size - start < size)
+    {
+        switch (nextRandom() % 8)
+        {
+        case 0:
+            put(buffer, cutPrefix, 3 + nextRandom() % (sizeof(cutPrefix) - 2));
+            break;
+        case 1:
+            put(buffer, yamaha, sizeof(yamaha));
+            break;
+        case 2:
+        case 3:
+        case 4:
+            byte = 0xF0;
+            put(buffer, &byte, 1);
+            break;
+        default:
+            byte = nextRandom() & 0xFF;
+            put(buffer, &byte, 1);
+            break;
+        }
+    }
+}
+
+/* A dump the size and shape of what Sierra games send: display text, system
+area, all 128 patches, a few dozen custom timbres and the rhythm setup. With
+junk set, logger noise goes in between the messages. */
+static void putSierraDump(Buffer *buffer, int number, int junk)
+{
+    unsigned char data[256];
+    int i, nTimbres = 20 + nextRandom() % 45;
+    char title[21];
+
+    sprintf(title, " Bench dump %-7d ", number % 10000000);
+    putDT1(buffer, 0x20, 0x00, 0x00, (const unsigned char *)title, 20);
+    randomData(data, 23);
+    putDT1(buffer, 0x10, 0x00, 0x00, data, 23);
+
+    for (i = 0; i < 4; i++)
+    {
+        if (junk)
+            putJunk(buffer, 64 + nextRandom() % 256);
+        randomData(data, 256);
+        putDT1(buffer, 0x05, i * 2, 0x00, data, 256);
+    }
+
+    for (i = 0; i < nTimbres; i++)
+    {
+        if (junk)
+            putJunk(buffer, 64 + nextRandom() % 256);
+        randomData(data, 246);
+        memcpy(data, "Timbre    ", 10);
+        data[7] = '0' + i / 10;
+        data[8] = '0' + i % 10;
+        putDT1(buffer, 0x08, i * 2, 0x00, data, 246);
+    }
+
+    randomData(data, 256);
+    putDT1(buffer, 0x03, 0x01, 0x10, data, 128);
+    putDT1(buffer, 0x03, 0x02, 0x10, data + 128, 128);
+}
+
+/* ********************************************************************* */
+/* Benchmark cases */
+
+typedef struct
+{
+    const char *name;
+    const char *description;
+    Buffer *files;
+    char **paths;
+    int nFiles;
+    size_t bytes;
+    unsigned long messages;
+    Syx2InsState *states;
+    Syx2InsResult *results;
+} BenchCase;
+
+static void allocFiles(BenchCase *bench, int nFiles)
+{
+    bench->files = calloc(nFiles, sizeof(*bench->files));
+    bench->nFiles = nFiles;
+}
+
+/* Typical game dumps, one per file */
+static void makeSierra(BenchCase *bench, int nFiles)
+{
+    int i;
+
+    allocFiles(bench, nFiles);
+    for (i = 0; i < nFiles; i++)
+        putSierraDump(&bench->files[i], i, 0);
+}
+
+/* Dumps concatenated into one huge capture */
+static void makeConcat(BenchCase *bench, size_t size)
+{
+    int i;
+
+    allocFiles(bench, 1);
+    for (i = 0; bench->files[0].size < size; i++)
+        putSierraDump(&bench->files[0], i, 0);
+}
+
+/* Dumps with logger noise full of F0 bytes between the messages */
+static void makeStray(BenchCase *bench, int nFiles)
+{
+    int i;
+
+    allocFiles(bench, nFiles);
+    for (i = 0; i < nFiles; i++)
+        putSierraDump(&bench->files[i], i, 1);
+}
+
+/* Lots of files holding only a title and one patch */
+static void makeTiny(BenchCase *bench, int nFiles)
+{
+    unsigned char data[8];
+    int i;
+
+    allocFiles(bench, nFiles);
+    for (i = 0; i < nFiles; i++)
+    {
+        putDT1(&bench->files[i], 0x20, 0x00, 0x00, (const unsigned char *)"    Tiny bench dump ", 20);
+        randomData(data, 8);
+        putDT1(&bench->files[i], 0x05, (i % 128) / 16, (i % 16) * 8, data, 8);
+    }
+}
+
+/* Write the case's files into dir so the load stage has something to open */
+static int saveFiles(BenchCase *bench, const char *dir)
+{
+    FILE *file;
+    int i, ok = 1;
+
+    bench->paths = calloc(bench->nFiles, sizeof(*bench->paths));
+    for (i = 0; i < bench->nFiles && ok; i++)
+    {
+        bench->paths[i] = malloc(strlen(dir) + strlen(bench->name) + 32);
+        sprintf(bench->paths[i], "%s/%s%05d.syx", dir, bench->name, i);
+        file = fopen(bench->paths[i], "wb");
+        ok = file && fwrite(bench->files[i].data, 1, bench->files[i].size, file) == bench->files[i].size;
+        ok = file && fclose(file) == 0 && ok;
+    }
+    return ok;
+}
+
+static void freeCase(BenchCase *bench)
+{
+    int i;
+
+    for (i = 0; i < bench->nFiles; i++)
+    {
+        free(bench->files[i].data);
+        if (bench->paths && bench->paths[i])
+        {
+            unlink(bench->paths[i]);
+            free(bench->paths[i]);
+        }
+    }
+    free(bench->files);
+    free(bench->paths);
+    free(bench->states);
+    free(bench->results);
+}
+
+/* ********************************************************************* */
+/* Stages. They run in this order, each one leaves behind what the next needs:
+extract fills states, resolve fills results. */
+
+static volatile unsigned benchSink;     //Keeps the compiler from dropping work whose result isn't used
+
+static void stageLoad(BenchCase *bench)
+{
+    InputFile input;
+    unsigned sum = 0;
+    unsigned long i;
+    int f;
+
+    for (f = 0; f < bench->nFiles; f++)
+    {
+        if (!openInput(bench->paths[f], &input))
+            continue;
+        /* Mapping alone reads nothing, touch every page like the parser would */
+        for (i = 0; i < input.size; i += 4096)
+            sum += input.data[i];
+        closeInput(&input);
+    }
+    benchSink = sum;
+}
+
+static void stageFrame(BenchCase *bench)
+{
+    unsigned long n = 0;
+    int f;
+
+    for (f = 0; f < bench->nFiles; f++)
+        n += syx2insCountMessages(bench->files[f].data, bench->files[f].size);
+    benchSink = n;
+}
+
+static int nCores;
+
+static void stagePFrame(BenchCase *bench)
+{
+    Syx2InsMessage *messages;
+    size_t n, total = 0;
+    int f;
+
+    for (f = 0; f < bench->nFiles; f++)
+    {
+        messages = captureFrame(bench->files[f].data, bench->files[f].size, nCores, &n);
+        total += n;
+        free(messages);
+    }
+    benchSink = total;
+}
+
+static void stageExtract(BenchCase *bench)
+{
+    int f;
+
+    for (f = 0; f < bench->nFiles; f++)
+    {
+        syx2insReset(&bench->states[f]);
+        syx2insParse(&bench->states[f], bench->files[f].data, bench->files[f].size);
+    }
+}
+
+static void stageResolve(BenchCase *bench)
+{
+    int f;
+
+    for (f = 0; f < bench->nFiles; f++)
+        syx2insResolve(&bench->states[f], &bench->results[f]);
+}
+
+static void stageEmit(BenchCase *bench)
+{
+    OutputBuffer out;
+    size_t total = 0;
+    int f;
+
+    for (f = 0; f < bench->nFiles; f++)
+    {
+        if (emitRender(FORMAT_INS, &bench->results[f], 1, &out))
+            total += out.size;
+        emitFree(&out);
+    }
+    benchSink = total;
+}
+
+typedef struct
+{
+    const char *name;
+    void (*run)(BenchCase *bench);
+} Stage;
+
+static const Stage stages[] =
+{
+    { "load", stageLoad },
+    { "frame", stageFrame },
+    { "pframe", stagePFrame },
+    { "extract", stageExtract },
+    { "resolve", stageResolve },
+    { "emit", stageEmit }
+};
+
+static double now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Seconds one run of the stage takes. The stage is repeated until a round lasts
+long enough to time, and the fastest of the rounds is kept since anything else
+the machine does can only make a round slower. */
+static double timeStage(const Stage *stage, BenchCase *bench, double roundSeconds)
+{
+    double start, elapsed, best = 0;
+    int round, reps;
+
+    for (round = 0; round < ROUNDS; round++)
+    {
+        reps = 0;
+        start = now();
+        do
+        {
+            stage->run(bench);
+            reps++;
+            elapsed = now() - start;
+        } while (elapsed < roundSeconds);
+
+        if (round == 0 || elapsed / reps < best)
+            best = elapsed / reps;
+    }
+    return best;
+}
+
+/* ********************************************************************* */
+/* Baselines: a text file with one "case stage MB/s ns/message" line per result */
+
+typedef struct
+{
+    char caseName[32];
+    char stageName[32];
+    double mbPerSec;
+    double nsPerMessage;
+} BenchResult;
+
+static int loadBaseline(const char *path, BenchResult **results)
+{
+    FILE *file = fopen(path, "r");
+    char line[256];
+    BenchResult result;
+    int n = 0, capacity = 0;
+
+    *results = 0;
+    if (!file)
+        return -1;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        if (line[0] == '#' || sscanf(line, "%31s %31s %lf %lf", result.caseName, result.stageName, &result.mbPerSec, &result.nsPerMessage) != 4)
+            continue;
+        if (n == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 32;
+            *results = realloc(*results, capacity * sizeof(**results));
+        }
+        (*results)[n++] = result;
+    }
+    fclose(file);
+    return n;
+}
+
+static const BenchResult *findBaseline(const BenchResult *baseline, int nBaseline, const BenchResult *result)
+{
+    int i;
+
+    for (i = 0; i < nBaseline; i++)
+        if (!strcmp(baseline[i].caseName, result->caseName) && !strcmp(baseline[i].stageName, result->stageName))
+            return &baseline[i];
+    return 0;
+}
+
+static int saveBaseline(const char *path, const BenchResult *results, int nResults, const char *scannerName, int quick, unsigned long long seed)
+{
+    FILE *file = fopen(path, "w");
+    int i, ok;
+
+    if (!file)
+        return 0;
+
+    fprintf(file, "# syx2insbench v%.2f baseline, %s scanner, seed %llu%s\n", SYX2INS_VERSION, scannerName, seed, quick ? ", quick corpus" : "");
+    fprintf(file, "# case stage MB/s ns/message\n");
+    for (i = 0; i < nResults; i++)
+        fprintf(file, "%s %s %.3f %.3f\n", results[i].caseName, results[i].stageName, results[i].mbPerSec, results[i].nsPerMessage);
+    ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
+
+/* ********************************************************************* */
+
+static void usage(const char *program)
+{
+    printf("usage:  %s  [-quick]  [-seed n]  [-compare baseline]  [-save baseline]  [-tolerance percent]\n", program);
+}
+
+int main(int argc, char *argv[])
+{
+    BenchCase cases[4];
+    BenchResult *results, *baseline = 0, *result;
+    const BenchResult *base;
+    const char *compareFile = 0, *saveFile = 0, *scannerName, *tempRoot;
+    unsigned long long seed = DEFAULT_SEED;
+    double tolerance = DEFAULT_TOLERANCE, roundSeconds, seconds, change;
+    char dir[4096];
+    int quick = 0, nBaseline = 0, nResults = 0, nRegressions = 0, a, c, s, f;
+
+    for (a = 1; a < argc; a++)
+    {
+        if (!strcmp(argv[a], "-quick"))
+            quick = 1;
+        else if (a + 1 == argc)
+            break;
+        else if (!strcmp(argv[a], "-seed"))
+            seed = strtoull(argv[++a], 0, 10);
+        else if (!strcmp(argv[a], "-compare"))
+            compareFile = argv[++a];
+        else if (!strcmp(argv[a], "-save"))
+            saveFile = argv[++a];
+        else if (!strcmp(argv[a], "-tolerance"))
+            tolerance = atof(argv[++a]);
+        else
+            break;
+    }
+    if (a != argc)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (compareFile)
+    {
+        nBaseline = loadBaseline(compareFile, &baseline);
+        if (nBaseline < 0)
+        {
+            printf("Can't read baseline \"%s\".\n", compareFile);
+            return 2;
+        }
+    }
+
+    scannerName = syx2insInit();
+    nCores = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? (int)sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    randomState = seed ? seed : DEFAULT_SEED;
+    roundSeconds = quick ? 0.01 : 0.05;
+
+    /* The full corpus follows the spec: 100 MB for the concatenation, thousands of
+    tiny files. -quick shrinks it for a fast check. */
+    memset(cases, 0, sizeof(cases));
+    cases[0].name = "sierra";
+    cases[0].description = "typical game dumps";
+    makeSierra(&cases[0], quick ? 16 : 64);
+    cases[1].name = "concat";
+    cases[1].description = "concatenated dumps";
+    makeConcat(&cases[1], (size_t)(quick ? 8 : 100) << 20);
+    cases[2].name = "stray";
+    cases[2].description = "dumps with stray F0 bytes";
+    makeStray(&cases[2], quick ? 16 : 64);
+    cases[3].name = "tiny";
+    cases[3].description = "one patch files";
+    makeTiny(&cases[3], quick ? 500 : 5000);
+
+    tempRoot = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    snprintf(dir, sizeof(dir), "%s/syx2insbench.XXXXXX", tempRoot);
+    if (!mkdtemp(dir))
+    {
+        printf("Can't create a directory in \"%s\".\n", tempRoot);
+        return 2;
+    }
+
+    results = calloc(NUM(cases) * NUM(stages), sizeof(*results));
+
+    printf("Syx2Ins benchmark  v%.2f    %s scanner, %d cores, seed %llu\n\n", SYX2INS_VERSION, scannerName, nCores, seed);
+    printf("%-8s %-8s %10s %12s %12s %8s\n", "case", "stage", "MB/s", "ns/message", "baseline", "change");
+
+    for (c = 0; c < (int)NUM(cases); c++)
+    {
+        BenchCase *bench = &cases[c];
+
+        if (!saveFiles(bench, dir))
+        {
+            printf("Can't write the %s corpus to \"%s\".\n", bench->name, dir);
+            freeCase(bench);
+            continue;
+        }
+
+        for (f = 0; f < bench->nFiles; f++)
+        {
+            bench->bytes += bench->files[f].size;
+            bench->messages += syx2insCountMessages(bench->files[f].data, bench->files[f].size);
+        }
+        bench->states = calloc(bench->nFiles, sizeof(*bench->states));
+        bench->results = calloc(bench->nFiles, sizeof(*bench->results));
+
+        printf("\n%s: %s, %d files, %.1f MB, %lu messages\n", bench->name, bench->description, bench->nFiles, bench->bytes / 1e6, bench->messages);
+
+        for (s = 0; s < (int)NUM(stages); s++)
+        {
+            seconds = timeStage(&stages[s], bench, roundSeconds);
+
+            result = &results[nResults++];
+            snprintf(result->caseName, sizeof(result->caseName), "%s", bench->name);
+            snprintf(result->stageName, sizeof(result->stageName), "%s", stages[s].name);
+            result->mbPerSec = bench->bytes / 1e6 / seconds;
+            result->nsPerMessage = seconds * 1e9 / (bench->messages ? bench->messages : 1);
+
+            printf("%-8s %-8s %10.1f %12.2f", result->caseName, result->stageName, result->mbPerSec, result->nsPerMessage);
+            base = findBaseline(baseline, nBaseline, result);
+            if (base)
+            {
+                change = (result->mbPerSec / base->mbPerSec - 1) * 100;
+                printf(" %12.1f %+7.1f%%", base->mbPerSec, change);
+                if (change < -tolerance)
+                {
+                    printf("  REGRESSION");
+                    nRegressions++;
+                }
+            }
+            printf("\n");
+        }
+
+        freeCase(bench);
+    }
+    rmdir(dir);
+
+    if (saveFile)
+    {
+        if (saveBaseline(saveFile, results, nResults, scannerName, quick, seed))
+            printf("\nBaseline saved to \"%s\".\n", saveFile);
+        else
+            printf("\nCan't write baseline \"%s\".\n", saveFile);
+    }
+    if (compareFile)
+        printf("\n%d of %d stages slower than \"%s\" by more than %.1f%%.\n", nRegressions, nResults, compareFile, tolerance);
+
+    free(results);
+    free(baseline);
+    return nRegressions ? 1 : 0;
+}
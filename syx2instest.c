@@ -0,0 +1,1164 @@
+/********************************************************************************
+*	SYX2INS regression tests						*
+*									*
+*	Small hand built inputs for the parts that are easy to break	*
+*	without noticing. Every test is a function in the table at the	*
+*	end, they run one after another and count their failed checks.	*
+*	Tests of the command line tool run ./syx2ins on files in a	*
+*	temporary directory.						*
+*									*
+*	The library is compiled into this file so tests can get at its	*
+*	internals. Exits with 1 if anything fails.			*
+********************************************************************************/
+#include "libsyx2ins.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <zlib.h>
+
+#include "timbreidx.h"
+#include "emit.h"
+#include "capture.h"
+#include "container.h"
+#include "archive.h"
+#include "insmerge.h"
+
+static int nChecks, nFailed;
+
+#define CHECK(condition)    check((condition) != 0, #condition, __LINE__)
+
+static void check(int ok, const char *what, int line)
+{
+    nChecks++;
+    if (!ok)
+    {
+        nFailed++;
+        printf("    line %d: %s failed\n", line, what);
+    }
+}
+
+/* ********************************************************************* */
+/* Building inputs */
+
+static uint64_t randomState = 20150711;
+
+static unsigned nextRandom(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return (unsigned)(randomState >> 32);
+}
+
+typedef struct
+{
+    unsigned char *data;
+    size_t size, capacity;
+} Buffer;
+
+static void put(Buffer *buffer, const void *data, size_t size)
+{
+    if (buffer->size + size > buffer->capacity)
+    {
+        while (buffer->size + size > buffer->capacity)
+            buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+static void putByte(Buffer *buffer, unsigned char byte)
+{
+    put(buffer, &byte, 1);
+}
+
+/* One DT1 message to the MT-32 at a1 a2 a3, with the checksum off by badSum */
+static void putDT1(Buffer *buffer, int a1, int a2, int a3, const void *data, size_t size, int badSum)
+{
+    unsigned char header[8] = { 0xF0, 0x41, 0x10, 0x16, 0x12 };
+    unsigned sum = a1 + a2 + a3 + badSum;
+    size_t i;
+
+    header[5] = a1;
+    header[6] = a2;
+    header[7] = a3;
+    for (i = 0; i < size; i++)
+        sum += ((const unsigned char *)data)[i];
+    put(buffer, header, sizeof(header));
+    put(buffer, data, size);
+    putByte(buffer, (128 - (sum & 0x7F)) & 0x7F);
+    putByte(buffer, 0xF7);
+}
+
+static void putLittleEndian(Buffer *buffer, unsigned long value, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        putByte(buffer, (value >> (i * 8)) & 0xFF);
+}
+
+static void putBigEndian(Buffer *buffer, unsigned long value, int n)
+{
+    while (n--)
+        putByte(buffer, (value >> (n * 8)) & 0xFF);
+}
+
+/* MIDI variable length number */
+static void putNumber(Buffer *buffer, unsigned long value)
+{
+    int shift = 21;
+
+    while (shift && !(value >> shift))
+        shift -= 7;
+    for (; shift; shift -= 7)
+        putByte(buffer, 0x80 | ((value >> shift) & 0x7F));
+    putByte(buffer, value & 0x7F);
+}
+
+/* A timbre named name with every parameter set to value, so each value makes a
+sound of its own */
+static void makeTimbre(unsigned char timbre[246], const char *name, int value)
+{
+    memset(timbre, value, 246);
+    memset(timbre, ' ', 10);
+    memcpy(timbre, name, strlen(name));
+}
+
+/* A dump with a display text and one custom timbre in slot 1, played by patch 1 */
+static void makeDump(Buffer *dump, const char *title, const char *timbreName, int value)
+{
+    static const unsigned char patch[8] = { 2, 0, 24, 50, 12, 0, 1, 0 };
+    unsigned char timbre[246];
+
+    dump->size = 0;
+    putDT1(dump, 0x20, 0x00, 0x00, title, strlen(title), 0);
+    makeTimbre(timbre, timbreName, value);
+    putDT1(dump, 0x08, 0x00, 0x00, timbre, sizeof(timbre), 0);
+    putDT1(dump, 0x05, 0x00, 0x00, patch, sizeof(patch), 0);
+}
+
+static char tempDir[] = "/tmp/syx2instest.XXXXXX";
+
+/* A path in the temporary directory, valid until the next call */
+static char *tempPath(const char *name)
+{
+    static char path[sizeof(tempDir) + 256];
+
+    sprintf(path, "%s/%s", tempDir, name);
+    return path;
+}
+
+static int saveFile(const char *path, const void *data, size_t size)
+{
+    FILE *file = fopen(path, "wb");
+    int ok;
+
+    if (!file)
+        return 0;
+    ok = fwrite(data, 1, size, file) == size;
+    return fclose(file) == 0 && ok;
+}
+
+/* The whole file with a NUL after it, NULL if it can't be read */
+static char *loadFile(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    char *data;
+    long length;
+
+    if (!file)
+        return 0;
+    fseek(file, 0, SEEK_END);
+    length = ftell(file);
+    rewind(file);
+    data = malloc(length + 1);
+    *size = fread(data, 1, length, file);
+    data[*size] = 0;
+    fclose(file);
+    return data;
+}
+
+static int countOf(const char *text, const char *what)
+{
+    int n = 0;
+
+    while (text && (text = strstr(text, what)) != 0)
+    {
+        n++;
+        text += strlen(what);
+    }
+    return n;
+}
+
+/* Run ./syx2ins with arguments in the temporary directory. Its output is kept
+in toolOutput. Returns the exit code. */
+static char *toolOutput;
+
+static int runTool(const char *arguments)
+{
+    char command[1024], cwd[512];
+    size_t size;
+    int status;
+
+    if (!getcwd(cwd, sizeof(cwd)))
+        return -1;
+    snprintf(command, sizeof(command), "cd %s && %s/syx2ins %s > tool.log 2>&1", tempDir, cwd, arguments);
+    status = system(command);
+    free(toolOutput);
+    toolOutput = loadFile(tempPath("tool.log"), &size);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/* ********************************************************************* */
+/* Scanners. Random dumps of intact and damaged messages mixed with other
+SysEx and stray bytes, so status bytes turn up at every offset of a vector. */
+
+static void makeMixedDump(Buffer *buffer, int nMessages)
+{
+    unsigned char data[300];
+    int i, j, length;
+
+    for (i = 0; i < nMessages; i++)
+    {
+        length = nextRandom() % sizeof(data);
+        for (j = 0; j < length; j++)
+            data[j] = nextRandom() & 0x7F;
+        switch (nextRandom() % 6)
+        {
+        case 0:
+            /* Stray bytes, some of them status bytes */
+            for (j = 0; j < length % 40; j++)
+                putByte(buffer, nextRandom() % 5 ? nextRandom() & 0x7F : nextRandom() | 0x80);
+            break;
+        case 1:
+            /* Cut short by the next message */
+            putDT1(buffer, 0x08, nextRandom() & 0x7F, 0, data, length, 0);
+            buffer->size -= 1 + nextRandom() % (length + 2);
+            break;
+        case 2:
+            putDT1(buffer, 0x05, nextRandom() & 0x7F, 0, data, length, 1 + nextRandom() % 127);
+            break;
+        default:
+            putDT1(buffer, (int[]){ 0x03, 0x05, 0x08, 0x10, 0x20 }[nextRandom() % 5], nextRandom() & 0x7F,
+                nextRandom() & 0x7F, data, length, 0);
+            break;
+        }
+    }
+}
+
+#ifdef HAVE_X86_SCANNERS
+static const SysexScanner scanners[] =
+{
+    { findPrefixScalar, findStatusScalar },
+    { findPrefixSSE2, findStatusSSE2 },
+    { findPrefixAVX2, findStatusAVX2 },
+};
+static const char *scannerNames[] = { "scalar", "SSE2", "AVX2" };
+#else
+static const SysexScanner scanners[] = { { findPrefixScalar, findStatusScalar } };
+static const char *scannerNames[] = { "scalar" };
+#endif
+
+static void testScanners(void)
+{
+    static Syx2InsState states[NUM(scanners)];
+    Buffer dump = { 0 };
+    unsigned long pos, found[NUM(scanners)], sums[NUM(scanners)];
+    int nScanners = NUM(scanners), i, round;
+
+#ifdef HAVE_X86_SCANNERS
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2"))
+        nScanners--;
+#endif
+    printf("    comparing %s", scannerNames[0]);
+    for (i = 1; i < nScanners; i++)
+        printf(", %s", scannerNames[i]);
+    printf("\n");
+
+    for (round = 0; round < 50; round++)
+    {
+        dump.size = 0;
+        makeMixedDump(&dump, 1 + nextRandom() % 60);
+
+        /* Every starting position, so each scanner's tail handling gets its turn */
+        for (pos = 0; pos <= dump.size; pos++)
+        {
+            for (i = 0; i < nScanners; i++)
+            {
+                sums[i] = 0;
+                found[i] = scanners[i].findStatus(dump.data, pos, dump.size, &sums[i]);
+            }
+            for (i = 1; i < nScanners; i++)
+                CHECK(found[i] == found[0] && sums[i] == sums[0]);
+            for (i = 0; i < nScanners; i++)
+                found[i] = scanners[i].findPrefix(dump.data, pos, dump.size);
+            for (i = 1; i < nScanners; i++)
+                CHECK(found[i] == found[0]);
+        }
+
+        /* And the whole parse, damage reports included */
+        for (i = 0; i < nScanners; i++)
+        {
+            scanner = scanners[i];
+            syx2insReset(&states[i]);
+            syx2insParse(&states[i], dump.data, dump.size);
+        }
+        for (i = 1; i < nScanners; i++)
+            CHECK(!memcmp(&states[i], &states[0], sizeof(states[0])));
+        CHECK(syx2insCountMessages(dump.data, dump.size) == states[0].nMessages);
+    }
+
+    syx2insInit();
+    free(dump.data);
+}
+
+/* ********************************************************************* */
+/* Damaged messages. One of each kind between intact ones, all of them have to
+be counted and reported where they are, and the intact ones still applied.
+The tool tells how many it left out. */
+
+static void testDamage(void)
+{
+    static Syx2InsState state;
+    static Syx2InsResult result;
+    unsigned char timbre[246], system[30] = { 0 };
+    Buffer dump = { 0 };
+    size_t badSum, truncated, outOfRange, i;
+
+    makeTimbre(timbre, "INTACT", 1);
+    putDT1(&dump, 0x08, 0x00, 0x00, timbre, sizeof(timbre), 0);
+
+    badSum = dump.size;
+    makeTimbre(timbre, "BADSUM", 2);
+    putDT1(&dump, 0x08, 0x02, 0x00, timbre, sizeof(timbre), 5);
+
+    truncated = dump.size;
+    makeTimbre(timbre, "CUTSHORT", 3);
+    putDT1(&dump, 0x08, 0x04, 0x00, timbre, sizeof(timbre), 0);
+    dump.size -= 20;
+
+    /* The system area is 23 bytes long */
+    outOfRange = dump.size;
+    putDT1(&dump, 0x10, 0x00, 0x00, system, sizeof(system), 0);
+
+    makeTimbre(timbre, "LAST", 4);
+    putDT1(&dump, 0x08, 0x06, 0x00, timbre, sizeof(timbre), 0);
+
+    CHECK(syx2insConvert(dump.data, dump.size, &state, &result) == SYX2INS_OK);
+    CHECK(result.diagnostics.total == 3);
+    CHECK(result.diagnostics.counts[SYX2INS_BAD_CHECKSUM] == 1);
+    CHECK(result.diagnostics.counts[SYX2INS_TRUNCATED] == 1);
+    CHECK(result.diagnostics.counts[SYX2INS_OUT_OF_RANGE] == 1);
+    for (i = 0; i < 3 && i < result.diagnostics.total; i++)
+    {
+        switch (result.diagnostics.first[i].problem)
+        {
+        case SYX2INS_BAD_CHECKSUM:
+            CHECK(result.diagnostics.first[i].offset == badSum);
+            CHECK(result.diagnostics.first[i].address == SYX2INS_ADDRESS(0x08, 0x02, 0x00));
+            break;
+        case SYX2INS_TRUNCATED:
+            CHECK(result.diagnostics.first[i].offset == truncated);
+            break;
+        default:
+            CHECK(result.diagnostics.first[i].offset == outOfRange);
+            CHECK(result.diagnostics.first[i].address == SYX2INS_ADDRESS(0x10, 0x00, 0x00));
+            break;
+        }
+    }
+
+    CHECK(!strncmp(result.timbreNames[0], "INTACT", 6));
+    CHECK(!result.timbreWritten[1] && !result.timbreWritten[2]);
+    CHECK(!strncmp(result.timbreNames[3], "LAST", 4));
+
+    CHECK(saveFile(tempPath("damaged.syx"), dump.data, dump.size));
+    CHECK(runTool("damaged.syx damaged.INS") == 0);
+    CHECK(countOf(toolOutput, "3 damaged messages found"));
+    free(dump.data);
+}
+
+/* ********************************************************************* */
+/* Conversion cache. A rerun takes everything from the cache, a changed input is
+parsed again, and other output options never reuse the results. */
+
+static void saveDumps(const char *dir, const char *const *titles, int n)
+{
+    Buffer dump = { 0 };
+    char path[64];
+    int i;
+
+    mkdir(tempPath(dir), 0777);
+    for (i = 0; i < n; i++)
+    {
+        makeDump(&dump, titles[i], "TIMBRE", 1 + i);
+        sprintf(path, "%s/dump%d.syx", dir, i);
+        CHECK(saveFile(tempPath(path), dump.data, dump.size));
+    }
+    free(dump.data);
+}
+
+static void testCache(void)
+{
+    static const char *titles[] = { "ONE", "TWO", "THREE" }, *changed[] = { "OWN" };
+    size_t size;
+    char *ins;
+
+    saveDumps("cached", titles, 3);
+    mkdir(tempPath("cache"), 0777);
+    mkdir(tempPath("cachedout"), 0777);
+
+    CHECK(runTool("-batch cached -o cachedout -cache cache") == 0);
+    CHECK(countOf(toolOutput, "0 taken from the cache"));
+    CHECK(runTool("-batch cached -o cachedout -cache cache") == 0);
+    CHECK(countOf(toolOutput, "3 taken from the cache, 3 INS files already up to date"));
+
+    /* Same size, other contents */
+    saveDumps("cached", changed, 1);
+    CHECK(runTool("-batch cached -o cachedout -cache cache") == 0);
+    CHECK(countOf(toolOutput, "2 taken from the cache"));
+    ins = loadFile(tempPath("cachedout/dump0.INS"), &size);
+    CHECK(countOf(ins, "OWN") && !countOf(ins, "ONE"));
+    free(ins);
+
+    CHECK(runTool("-batch cached -o cachedout -cache cache -format ins,json") == 0);
+    CHECK(countOf(toolOutput, "0 taken from the cache"));
+    CHECK(runTool("-batch cached -o cachedout -cache cache -uploads") == 0);
+    CHECK(countOf(toolOutput, "0 taken from the cache"));
+}
+
+/* ********************************************************************* */
+/* Timbre index. The same sound under two names is found together, the records
+are aligned even with a single bucket, and a damaged bucket table is refused. */
+
+static void convertDump(const char *title, const char *timbreName, int value, Syx2InsResult *result)
+{
+    static Syx2InsState state;
+    Buffer dump = { 0 };
+
+    makeDump(&dump, title, timbreName, value);
+    CHECK(syx2insConvert(dump.data, dump.size, &state, result) == SYX2INS_OK);
+    free(dump.data);
+}
+
+static void testIndex(void)
+{
+    static Syx2InsResult organ, renamed, brass;
+    const char *path = strdup(tempPath("timbres.idx"));
+    TimbreIndexBuilder builder;
+    TimbreIndex index;
+    const TimbreRecord *first;
+    TimbreIndexHeader header;
+    Buffer dump = { 0 };
+    uint32_t badBucket = 5;
+    size_t n, size, i;
+    char *image;
+    int names = 0;
+
+    convertDump("ORGANS", "ORGAN", 1, &organ);
+    convertDump("RENAMED", "MY ORGAN", 1, &renamed);
+    convertDump("BRASSES", "BRASS", 60, &brass);
+    CHECK(organ.timbreHash[0] == renamed.timbreHash[0] && organ.timbreHash[0] != brass.timbreHash[0]);
+
+    timbreIndexBuilderInit(&builder);
+    timbreIndexAddFile(&builder, "organ.syx", &organ);
+    timbreIndexAddFile(&builder, "renamed.syx", &renamed);
+    timbreIndexAddFile(&builder, "brass.syx", &brass);
+    CHECK(timbreIndexWrite(&builder, path));
+    timbreIndexBuilderFree(&builder);
+
+    CHECK(timbreIndexOpen(&index, path));
+    if (index.header)
+    {
+        n = timbreIndexFind(&index, organ.timbreHash[0], &first);
+        CHECK(n == 2);
+        for (i = 0; i < n; i++)
+        {
+            names += !strncmp(first[i].name, "ORGAN", 5) && !strcmp(timbreIndexFile(&index, first[i].file), "organ.syx");
+            names += !strncmp(first[i].name, "MY ORGAN", 8) && !strcmp(timbreIndexFile(&index, first[i].file), "renamed.syx");
+            CHECK(first[i].slot == 0);
+        }
+        CHECK(names == 2);
+        CHECK(timbreIndexFind(&index, brass.timbreHash[0], &first) == 1);
+        CHECK(timbreIndexFind(&index, brass.timbreHash[0] ^ 1, &first) == 0);
+        timbreIndexClose(&index);
+    }
+
+    /* One record, one bucket */
+    timbreIndexBuilderInit(&builder);
+    timbreIndexAddFile(&builder, "brass.syx", &brass);
+    CHECK(timbreIndexWrite(&builder, path));
+    timbreIndexBuilderFree(&builder);
+    CHECK(timbreIndexOpen(&index, path));
+    CHECK(index.header && index.header->bucketBits == 0 && (uintptr_t)index.records % sizeof(uint64_t) == 0);
+    timbreIndexClose(&index);
+
+    image = loadFile(path, &size);
+    CHECK(image && size > sizeof(header));
+    if (image)
+    {
+        memcpy(image + sizeof(header), &badBucket, sizeof(badBucket));
+        CHECK(saveFile(path, image, size));
+        CHECK(!timbreIndexOpen(&index, path));
+    }
+    free(image);
+
+    /* And through the tool */
+    mkdir(tempPath("indexed"), 0777);
+    mkdir(tempPath("indexedout"), 0777);
+    makeDump(&dump, "ORGANS", "ORGAN", 1);
+    CHECK(saveFile(tempPath("indexed/organ.syx"), dump.data, dump.size));
+    makeDump(&dump, "RENAMED", "MY ORGAN", 1);
+    CHECK(saveFile(tempPath("indexed/renamed.syx"), dump.data, dump.size));
+    CHECK(runTool("-batch indexed -o indexedout -index indexed.idx") == 0);
+    CHECK(runTool("-lookup indexed.idx indexed/renamed.syx") == 0);
+    CHECK(countOf(toolOutput, "indexed/organ.syx") && countOf(toolOutput, "ORGAN"));
+
+    free(dump.data);
+    free((char *)path);
+}
+
+/* ********************************************************************* */
+/* Similar timbres. The nearest named timbre wins over a placeholder and a blank
+name that sound exactly like the query, and nothing is found once the only
+close name is left out or the query sounds like none of them. */
+
+static void testSimilar(void)
+{
+    static Syx2InsResult piano, placeholder, blank, brass;
+    static const char *files[] = { "piano.syx", "placeholder.syx", "blank.syx", "brass.syx" };
+    const Syx2InsResult *banks[] = { &piano, &placeholder, &blank, &brass };
+    const char *path = strdup(tempPath("similar.idx"));
+    unsigned char query[SYX2INS_TIMBRE_FEATURES];
+    const TimbreRecord *nearest;
+    TimbreIndexBuilder builder;
+    TimbreIndex index;
+    unsigned distance;
+    int i;
+
+    convertDump("PIANOS", "PIANO", 1, &piano);
+    convertDump("EDITOR", "NEW TIMBRE", 1, &placeholder);
+    convertDump("BLANK", "", 1, &blank);
+    convertDump("BRASSES", "BRASS", 60, &brass);
+
+    timbreIndexBuilderInit(&builder);
+    for (i = 0; i < 4; i++)
+        timbreIndexAddFile(&builder, files[i], banks[i]);
+    CHECK(timbreIndexWrite(&builder, path));
+    timbreIndexBuilderFree(&builder);
+    if (!timbreIndexOpen(&index, path))
+    {
+        CHECK(!"opening the index");
+        return;
+    }
+
+    memcpy(query, piano.timbreFeatures[0], sizeof(query));
+    query[0] += 3;
+    CHECK(timbreIndexNearest(&index, query, UINT32_MAX, TIMBRE_SIMILAR_DISTANCE, &nearest, &distance));
+    CHECK(nearest && !strncmp(nearest->name, "PIANO", 5) && distance == 3);
+    if (nearest)
+        CHECK(!timbreIndexNearest(&index, query, nearest->file, TIMBRE_SIMILAR_DISTANCE, &nearest, &distance));
+
+    CHECK(timbreIndexNearest(&index, brass.timbreFeatures[0], UINT32_MAX, TIMBRE_SIMILAR_DISTANCE, &nearest, &distance));
+    CHECK(nearest && !strncmp(nearest->name, "BRASS", 5) && distance == 0);
+
+    for (i = 0; i < SYX2INS_TIMBRE_FEATURES; i++)
+        query[i] = 255 - piano.timbreFeatures[0][i];
+    CHECK(!timbreIndexNearest(&index, query, UINT32_MAX, TIMBRE_SIMILAR_DISTANCE, &nearest, &distance));
+
+    timbreIndexClose(&index);
+    free((char *)path);
+}
+
+/* ********************************************************************* */
+/* Emitters. Every format renders both banks within its size bound, quotes and
+backslashes in titles are escaped the way the format wants, and a custom timbre
+shows up as the patch that plays it. */
+
+static char *renderText(OutputFormat format, const Syx2InsResult *banks, int nBanks)
+{
+    OutputBuffer out;
+    char *text;
+
+    if (!emitRender(format, banks, nBanks, &out))
+        return 0;
+    CHECK(!out.overflow && out.size <= emitters[format].maxSize(banks, nBanks));
+    text = malloc(out.size + 1);
+    memcpy(text, out.data, out.size);
+    text[out.size] = 0;
+    emitFree(&out);
+    return text;
+}
+
+static void testEmitters(void)
+{
+    static Syx2InsResult banks[2];
+    char *text;
+    int format;
+
+    convertDump("SAY \"HI\" \\", "MY TIMBRE", 1, &banks[0]);
+    convertDump("SECOND", "OTHER", 2, &banks[1]);
+
+    for (format = 0; format < NUM_FORMATS; format++)
+    {
+        text = renderText(format, banks, 2);
+        CHECK(text);
+        switch (format)
+        {
+        case FORMAT_INS:
+            CHECK(countOf(text, "[SAY \"HI\" \\ Patch Bank]\n0=MY TIMBRE \n"));
+            CHECK(countOf(text, "[SECOND Patch Bank]\n0=OTHER     \n"));
+            break;
+        case FORMAT_JSON:
+            CHECK(countOf(text, "\"title\": \"SAY \\\"HI\\\" \\\\\""));
+            CHECK(countOf(text, "{ \"number\": 0, \"name\": \"MY TIMBRE \", \"set\": true }"));
+            CHECK(countOf(text, "{") == countOf(text, "}") && countOf(text, "[") == countOf(text, "]"));
+            break;
+        case FORMAT_CSV:
+            CHECK(!strncmp(text, "bank,kind,number,name,set\r\n", 27));
+            CHECK(countOf(text, "\"SAY \"\"HI\"\" \\\",patch,0,\"MY TIMBRE \",1\r\n"));
+            CHECK(countOf(text, "\"SECOND\",timbre,0,\"OTHER     \",1\r\n"));
+            break;
+        case FORMAT_SCI:
+            CHECK(countOf(text, "\n") == 128 + 2 + 128);
+            CHECK(!strncmp(text, "MY TIMBRE \n", 11));
+            CHECK(countOf(text, "\n; SECOND\nOTHER     \n"));
+            break;
+        }
+        free(text);
+    }
+}
+
+/* ********************************************************************* */
+/* Rhythm setup. Keys play a memory timbre, a rhythm timbre or nothing, keys the
+dump doesn't write keep their power-on drum, and a key past 87 makes it a
+CM-32L dump. The INS lists them as note names for the channel 10 instrument. */
+
+static void testRhythm(void)
+{
+    static Syx2InsState state;
+    static Syx2InsResult result;
+    static const unsigned char keys[3][4] =
+    {
+        { 0, 100, 7, 1 },           //Key 36: memory timbre 1
+        { 64 + 12, 80, 3, 0 },      //Key 38: Cowbell
+        { RHYTHM_OFF, 0, 7, 0 }     //Key 40: off
+    };
+    static const unsigned char windchime[4] = { 64 + 40, 100, 7, 1 };
+    Buffer dump = { 0 };
+    char *text;
+    int i;
+
+    makeDump(&dump, "DRUMS", "MY DRUM", 1);
+    for (i = 0; i < 3; i++)
+        putDT1(&dump, 0x03, 0x01, 0x40 + i * 8, keys[i], 4, 0);
+    CHECK(syx2insConvert(dump.data, dump.size, &state, &result) == SYX2INS_OK);
+    CHECK(result.device == SYX2INS_MT32);
+    CHECK(!strcmp(result.rhythmNames[36 - 24], "MY DRUM   "));
+    CHECK(!strcmp(result.rhythmNames[38 - 24], "Cowbell"));
+    CHECK(!result.rhythmNames[40 - 24][0]);
+    CHECK(!strcmp(result.rhythmNames[35 - 24], "Acou BD") && !result.rhythmWritten[35 - 24]);
+    CHECK(!result.rhythmNames[88 - 24][0]);
+
+    text = renderText(FORMAT_INS, &result, 1);
+    CHECK(countOf(text, "[DRUMS Rhythm]\n35=Acou BD\n36=MY DRUM   \n37=Rim Shot\n38=Cowbell\n39=Hand Clap\n41=") == 1);
+    CHECK(countOf(text, "Key[*,*]=DRUMS Rhythm\nDrum[*,*]=1\n") == 1);
+    CHECK(strstr(text, ".Note Names") && !countOf(strstr(text, ".Note Names"), "\n88="));
+    free(text);
+    text = renderText(FORMAT_JSON, &result, 1);
+    CHECK(countOf(text, "{ \"key\": 38, \"name\": \"Cowbell\", \"level\": 80, \"pan\": 3, \"reverb\": false, \"set\": true }"));
+    CHECK(!countOf(text, "{ \"key\": 40,"));
+    free(text);
+
+    /* Key 100 only exists on the CM-32L */
+    putDT1(&dump, 0x03, 0x03, 0x40, windchime, 4, 0);
+    CHECK(syx2insConvert(dump.data, dump.size, &state, &result) == SYX2INS_OK);
+    CHECK(result.device == SYX2INS_CM32L);
+    CHECK(!strcmp(result.rhythmNames[100 - 24], "Windchime"));
+    text = renderText(FORMAT_INS, &result, 1);
+    CHECK(countOf(text, "\n100=Windchime\n") == 1);
+    free(text);
+    free(dump.data);
+}
+
+/* ********************************************************************* */
+/* Upload splitting. Each upload of a capture gets a bank with its own title and
+damaged messages, an upload to another device ID gets none, and a capture
+without MT-32 messages is framed once and found empty. */
+
+static void testUploads(void)
+{
+    static Syx2InsState state;
+    Syx2InsResult *banks;
+    unsigned char timbre[246];
+    unsigned char *empty;
+    Buffer capture = { 0 };
+    size_t other;
+    int nBanks;
+
+    putDT1(&capture, 0x20, 0x00, 0x00, "GAME ONE", 8, 0);
+    makeTimbre(timbre, "FIRST", 1);
+    putDT1(&capture, 0x08, 0x00, 0x00, timbre, sizeof(timbre), 0);
+
+    putDT1(&capture, 0x20, 0x00, 0x00, "GAME TWO", 8, 0);
+    makeTimbre(timbre, "SECOND", 2);
+    putDT1(&capture, 0x08, 0x02, 0x00, timbre, sizeof(timbre), 0);
+    putDT1(&capture, 0x08, 0x04, 0x00, timbre, sizeof(timbre), 3);
+
+    /* Sent to device 17 */
+    other = capture.size;
+    putDT1(&capture, 0x20, 0x00, 0x00, "ELSEWHERE", 9, 0);
+    makeTimbre(timbre, "THIRD", 3);
+    putDT1(&capture, 0x08, 0x06, 0x00, timbre, sizeof(timbre), 0);
+    capture.data[other + 2] = 0x11;
+
+    syx2insReset(&state);
+    CHECK(captureUploads(&state, capture.data, capture.size, 1, &banks, &nBanks));
+    CHECK(nBanks == 2);
+    if (nBanks == 2)
+    {
+        CHECK(!strncmp(banks[0].title, "GAME ONE", 8) && !strncmp(banks[0].timbreNames[0], "FIRST", 5));
+        CHECK(banks[0].diagnostics.total == 0);
+        CHECK(!strncmp(banks[1].title, "GAME TWO", 8) && !strncmp(banks[1].timbreNames[1], "SECOND", 6));
+        CHECK(banks[1].diagnostics.total == 1 && banks[1].diagnostics.counts[SYX2INS_BAD_CHECKSUM] == 1);
+    }
+    CHECK(state.diagnostics.total == 1);
+    free(banks);
+
+    /* Big enough to be framed on several threads */
+    empty = calloc(CAPTURE_PARALLEL_MIN + 1, 1);
+    empty[0] = 0xF0;
+    syx2insReset(&state);
+    CHECK(captureUploads(&state, empty, CAPTURE_PARALLEL_MIN + 1, 4, &banks, &nBanks));
+    CHECK(nBanks == 0 && !banks && state.nMessages == 0);
+    free(empty);
+    free(capture.data);
+}
+
+/* ********************************************************************* */
+/* Standard MIDI Files. The title comes on the second track at tick 0 and has to
+be applied before the timbre the first track sends at tick 10 in two packets,
+with running status channel messages around it. */
+
+static void putTrack(Buffer *file, const Buffer *track)
+{
+    put(file, "MTrk", 4);
+    putBigEndian(file, track->size, 4);
+    put(file, track->data, track->size);
+}
+
+static void testSMF(void)
+{
+    static Syx2InsState state;
+    static Syx2InsResult result;
+    static const unsigned char endOfTrack[] = { 0x00, 0xFF, 0x2F, 0x00 };
+    unsigned char timbre[246];
+    Buffer file = { 0 }, track = { 0 }, message = { 0 };
+    size_t half;
+
+    put(&file, "MThd", 4);
+    putBigEndian(&file, 6, 4);
+    putBigEndian(&file, 1, 2);      //Format 1
+    putBigEndian(&file, 2, 2);      //Two tracks
+    putBigEndian(&file, 96, 2);
+
+    makeTimbre(timbre, "SMF TIMBRE", 1);
+    putDT1(&message, 0x08, 0x00, 0x00, timbre, sizeof(timbre), 0);
+    half = message.size / 2;
+    put(&track, (unsigned char[]){ 0x00, 0x90, 0x3C, 0x40, 0x05, 0x3C, 0x00 }, 7);
+    put(&track, (unsigned char[]){ 0x05, 0xF0 }, 2);
+    putNumber(&track, half - 1);
+    put(&track, message.data + 1, half - 1);
+    put(&track, (unsigned char[]){ 0x00, 0xF7 }, 2);
+    putNumber(&track, message.size - half);
+    put(&track, message.data + half, message.size - half);
+    put(&track, endOfTrack, sizeof(endOfTrack));
+    putTrack(&file, &track);
+
+    track.size = message.size = 0;
+    putDT1(&message, 0x20, 0x00, 0x00, "SMF TITLE", 9, 0);
+    put(&track, (unsigned char[]){ 0x00, 0xF0 }, 2);
+    putNumber(&track, message.size - 1);
+    put(&track, message.data + 1, message.size - 1);
+    put(&track, endOfTrack, sizeof(endOfTrack));
+    putTrack(&file, &track);
+
+    CHECK(containerDetect(file.data, file.size) == CONTAINER_SMF);
+    CHECK(containerConvert(file.data, file.size, &state, &result) == SYX2INS_OK);
+    CHECK(!strncmp(result.title, "SMF TITLE", 9));
+    CHECK(!strncmp(result.timbreNames[0], "SMF TIMBRE", 10));
+    CHECK(result.diagnostics.total == 0);
+
+    free(file.data);
+    free(track.data);
+    free(message.data);
+}
+
+/* ********************************************************************* */
+/* SCI patch.001. The bank is named after the done text, not the loading banner
+the driver shows while it uploads. */
+
+static void testSCI(void)
+{
+    static Syx2InsState state;
+    static Syx2InsResult result;
+    unsigned char texts[60], patches[48 * 8] = { 0 }, timbre[246], padding[44] = { 0 };
+    Buffer file = { 0 };
+
+    memset(texts, ' ', sizeof(texts));
+    memcpy(texts, "KQ Done Text", 12);
+    memcpy(texts + 20, "Loading KQ...", 13);
+    memcpy(texts + 40, "Goodbye", 7);
+    patches[0] = 2;                 //Patch 1 plays memory timbre 1
+    makeTimbre(timbre, "SCI TIMBRE", 1);
+
+    putByte(&file, 0x89);
+    putByte(&file, 0x00);
+    put(&file, texts, sizeof(texts));
+    put(&file, padding, 3);
+    put(&file, padding, 44);
+    put(&file, patches, sizeof(patches));
+    putByte(&file, 1);
+    put(&file, timbre, sizeof(timbre));
+
+    CHECK(containerDetect(file.data, file.size) == CONTAINER_SCI_PATCH);
+    CHECK(containerConvert(file.data, file.size, &state, &result) == SYX2INS_OK);
+    CHECK(!strncmp(result.title, "KQ Done Text", 12));
+    CHECK(!strncmp(result.timbreNames[0], "SCI TIMBRE", 10));
+    CHECK(!strncmp(result.patchNames[0], "SCI TIMBRE", 10));
+    free(file.data);
+}
+
+/* ********************************************************************* */
+/* Archives. Each damaged one has to be refused or its member fail to load, never
+read past the end of the file. The zip member is stored, so claiming a different
+unpacked size than it takes up is damage too. A .tar.gz may not claim or unpack
+to more than the limit, however well it compresses. */
+
+static const char memberData[] = "\xF0\x41\x10\x16\x12 not really a dump \xF7";
+
+static void makeZip(Buffer *zip, unsigned long size, unsigned long crc)
+{
+    size_t central, centralSize;
+
+    zip->size = 0;
+    putLittleEndian(zip, 0x04034B50, 4);
+    putLittleEndian(zip, 10, 2);
+    putLittleEndian(zip, 0, 2);         //Flags
+    putLittleEndian(zip, 0, 2);         //Stored
+    putLittleEndian(zip, 0, 4);         //Time and date
+    putLittleEndian(zip, crc, 4);
+    putLittleEndian(zip, sizeof(memberData), 4);
+    putLittleEndian(zip, size, 4);
+    putLittleEndian(zip, 7, 2);
+    putLittleEndian(zip, 0, 2);
+    put(zip, "kq1.syx", 7);
+    put(zip, memberData, sizeof(memberData));
+
+    central = zip->size;
+    putLittleEndian(zip, 0x02014B50, 4);
+    putLittleEndian(zip, 20, 2);
+    putLittleEndian(zip, 10, 2);
+    putLittleEndian(zip, 0, 2);
+    putLittleEndian(zip, 0, 2);
+    putLittleEndian(zip, 0, 4);
+    putLittleEndian(zip, crc, 4);
+    putLittleEndian(zip, sizeof(memberData), 4);
+    putLittleEndian(zip, size, 4);
+    putLittleEndian(zip, 7, 2);
+    putLittleEndian(zip, 0, 2);         //Extra field
+    putLittleEndian(zip, 0, 2);         //Comment
+    putLittleEndian(zip, 0, 2);         //Disk
+    putLittleEndian(zip, 0, 2);         //Internal attributes
+    putLittleEndian(zip, 0, 4);         //External attributes
+    putLittleEndian(zip, 0, 4);         //Local header offset
+    put(zip, "kq1.syx", 7);
+    centralSize = zip->size - central;
+
+    putLittleEndian(zip, 0x06054B50, 4);
+    putLittleEndian(zip, 0, 4);
+    putLittleEndian(zip, 1, 2);
+    putLittleEndian(zip, 1, 2);
+    putLittleEndian(zip, centralSize, 4);
+    putLittleEndian(zip, central, 4);
+    putLittleEndian(zip, 0, 2);
+}
+
+static void makeTar(Buffer *tar, unsigned long size, int badSum)
+{
+    unsigned char header[512] = { 0 }, padding[512] = { 0 };
+    unsigned sum = 0;
+    int i;
+
+    tar->size = 0;
+    strcpy((char *)header, "kq1.syx");
+    strcpy((char *)header + 100, "0000644");
+    sprintf((char *)header + 124, "%011lo", size);
+    strcpy((char *)header + 136, "00000000000");
+    memset(header + 148, ' ', 8);
+    header[156] = '0';
+    memcpy(header + 257, "ustar", 6);
+    for (i = 0; i < 512; i++)
+        sum += header[i];
+    sprintf((char *)header + 148, "%06o", sum + badSum);
+    put(tar, header, sizeof(header));
+    put(tar, memberData, sizeof(memberData));
+    put(tar, padding, 512 - sizeof(memberData));
+    put(tar, padding, sizeof(padding));
+    put(tar, padding, sizeof(padding));
+}
+
+/* Gzip data followed by a run of zeros, in chunks so a bomb needn't be held
+unpacked */
+static void makeGzip(Buffer *gz, const Buffer *data, size_t zeros)
+{
+    static unsigned char zero[1 << 20], out[1 << 16];
+    z_stream zs;
+    size_t n;
+    int flush;
+
+    gz->size = 0;
+    memset(&zs, 0, sizeof(zs));
+    CHECK(deflateInit2(&zs, 9, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+    zs.next_in = data->data;
+    zs.avail_in = data->size;
+    do
+    {
+        if (!zs.avail_in && zeros)
+        {
+            n = zeros < sizeof(zero) ? zeros : sizeof(zero);
+            zs.next_in = zero;
+            zs.avail_in = n;
+            zeros -= n;
+        }
+        flush = zeros ? Z_NO_FLUSH : Z_FINISH;
+        do
+        {
+            zs.next_out = out;
+            zs.avail_out = sizeof(out);
+            deflate(&zs, flush);
+            put(gz, out, sizeof(out) - zs.avail_out);
+        } while (!zs.avail_out);
+    } while (flush != Z_FINISH);
+    deflateEnd(&zs);
+}
+
+/* 1 if the archive opens and its one member loads with the right contents, 0 if
+either is refused */
+static int loadsMember(const Buffer *file, const char *name)
+{
+    const char *path = tempPath(name);
+    Archive archive;
+    InputFile input;
+    int ok;
+
+    if (!saveFile(path, file->data, file->size) || !archiveOpen(&archive, path))
+        return 0;
+    ok = archive.nMembers == 1 && archiveLoad(&archive, 0, &input);
+    if (ok)
+    {
+        CHECK(input.size == sizeof(memberData) && !memcmp(input.data, memberData, sizeof(memberData)));
+        closeInput(&input);
+    }
+    archiveClose(&archive);
+    return ok;
+}
+
+static void testArchives(void)
+{
+    unsigned long crc = crc32(0, (const unsigned char *)memberData, sizeof(memberData));
+    Buffer file = { 0 }, tar = { 0 };
+
+    makeZip(&file, sizeof(memberData), crc);
+    CHECK(loadsMember(&file, "good.zip"));
+    makeZip(&file, 0x7FFFFFFF, crc);
+    CHECK(!loadsMember(&file, "huge.zip"));
+    makeZip(&file, sizeof(memberData), crc ^ 1);
+    CHECK(!loadsMember(&file, "crc.zip"));
+    makeZip(&file, sizeof(memberData), crc);
+    file.size -= 10;
+    CHECK(!loadsMember(&file, "cut.zip"));
+
+    makeTar(&file, sizeof(memberData), 0);
+    CHECK(loadsMember(&file, "good.tar"));
+    makeTar(&file, 0x7FFFFFFF, 0);
+    CHECK(!loadsMember(&file, "huge.tar"));
+    makeTar(&file, sizeof(memberData), 1);
+    CHECK(!loadsMember(&file, "sum.tar"));
+    makeTar(&file, sizeof(memberData), 0);
+    file.size = 512 + 10;
+    CHECK(!loadsMember(&file, "cut.tar"));
+
+    makeTar(&tar, sizeof(memberData), 0);
+    makeGzip(&file, &tar, 0);
+    CHECK(loadsMember(&file, "good.tar.gz"));
+    memset(file.data + file.size - 4, 0xFF, 4);
+    CHECK(!loadsMember(&file, "claims.tar.gz"));
+    makeGzip(&file, &tar, (size_t)65 << 20);
+    CHECK(!loadsMember(&file, "bomb.tar.gz"));
+
+    free(file.data);
+    free(tar.data);
+}
+
+/* ********************************************************************* */
+/* INS merge. Merging a bank's own INS text back into its file changes nothing,
+a second bank is added next to the first and merging again keeps it at one.
+Single mode has to own up when the INS can't be written, merged or not. */
+
+static void testMerge(void)
+{
+    static Syx2InsResult banks[2];
+    const char *path = strdup(tempPath("merge.ins"));
+    char *first, *second, *before, *after;
+    size_t beforeSize, afterSize;
+    Buffer dump = { 0 };
+
+    convertDump("FIRST GAME", "ONE", 1, &banks[0]);
+    convertDump("SECOND GAME", "TWO", 2, &banks[1]);
+    first = renderText(FORMAT_INS, &banks[0], 1);
+    second = renderText(FORMAT_INS, &banks[1], 1);
+
+    CHECK(saveFile(path, first, strlen(first)));
+    CHECK(insMergeFile(path, first, strlen(first)));
+    after = loadFile(path, &afterSize);
+    CHECK(after && afterSize == strlen(first) && !memcmp(after, first, afterSize));
+    free(after);
+
+    CHECK(insMergeFile(path, second, strlen(second)));
+    before = loadFile(path, &beforeSize);
+    CHECK(before && countOf(before, "FIRST GAME") && countOf(before, "SECOND GAME"));
+    CHECK(insMergeFile(path, second, strlen(second)));
+    after = loadFile(path, &afterSize);
+    CHECK(before && after && afterSize == beforeSize && !memcmp(after, before, beforeSize));
+    CHECK(after && countOf(after, "ONE") == countOf(first, "ONE"));
+    free(before);
+    free(after);
+
+    makeDump(&dump, "SINGLE", "TIMBRE", 1);
+    CHECK(saveFile(tempPath("single.syx"), dump.data, dump.size));
+    CHECK(runTool("single.syx single.INS -metrics written.json") == 0);
+    CHECK(countOf(toolOutput, "DONE!"));
+    after = loadFile(tempPath("written.json"), &afterSize);
+    CHECK(after && countOf(after, "\"failed\": 0,"));
+    free(after);
+
+    CHECK(runTool("single.syx nowhere/single.INS -metrics unwritten.json") == 0);
+    CHECK(countOf(toolOutput, "Can't write \"nowhere/single.INS\"") && !countOf(toolOutput, "DONE!"));
+    after = loadFile(tempPath("unwritten.json"), &afterSize);
+    CHECK(after && countOf(after, "\"failed\": 1,"));
+    free(after);
+
+    /* A directory opens for reading, so it looks like an INS to merge into */
+    mkdir(tempPath("folder.INS"), 0777);
+    CHECK(runTool("-merge single.syx folder.INS -metrics unmerged.json") == 0);
+    CHECK(countOf(toolOutput, "Can't write \"folder.INS\"") && !countOf(toolOutput, "DONE!"));
+    after = loadFile(tempPath("unmerged.json"), &afterSize);
+    CHECK(after && countOf(after, "\"failed\": 1,"));
+    free(after);
+
+    free(first);
+    free(second);
+    free(dump.data);
+    free((char *)path);
+}
+
+/* ********************************************************************* */
+/* Batch output names. Two inputs with the same base name keep apart, and the
+new name skips one another input already has. */
+
+static void testBatchNames(void)
+{
+    static const char *inputs[] = { "song.syx", "song.SYX", "song-2.syx" };
+    static const char *titles[] = { "FIRST", "SECOND", "THIRD" };
+    static const char *outputs[] = { "out/song.INS", "out/song-2.INS", "out/song-3.INS" };
+    char *ins[3], path[64];
+    Buffer dump = { 0 };
+    size_t size;
+    int i, j, found;
+
+    mkdir(tempPath("names"), 0777);
+    mkdir(tempPath("out"), 0777);
+    for (i = 0; i < 3; i++)
+    {
+        makeDump(&dump, titles[i], "TIMBRE", 1);
+        sprintf(path, "names/%s", inputs[i]);
+        CHECK(saveFile(tempPath(path), dump.data, dump.size));
+    }
+
+    CHECK(runTool("-batch names -o out") == 0);
+    CHECK(countOf(toolOutput, "writing \"") == 1);
+    for (i = 0; i < 3; i++)
+        ins[i] = loadFile(tempPath(outputs[i]), &size);
+    for (i = 0; i < 3; i++)
+    {
+        CHECK(ins[i]);
+        for (found = 0, j = 0; j < 3; j++)
+            found += countOf(ins[j], titles[i]) != 0;
+        CHECK(found == 1);
+    }
+
+    for (i = 0; i < 3; i++)
+        free(ins[i]);
+    free(dump.data);
+}
+
+/* ********************************************************************* */
+
+typedef struct
+{
+    const char *name;
+    void (*run)(void);
+} Test;
+
+static const Test tests[] =
+{
+    { "scanners", testScanners },
+    { "batch names", testBatchNames },
+    { "damage", testDamage },
+    { "cache", testCache },
+    { "index", testIndex },
+    { "similar", testSimilar },
+    { "emitters", testEmitters },
+    { "uploads", testUploads },
+    { "smf", testSMF },
+    { "sci", testSCI },
+    { "archives", testArchives },
+    { "rhythm", testRhythm },
+    { "merge", testMerge },
+    { 0 }
+};
+
+int main(void)
+{
+    char command[sizeof(tempDir) + 16];
+    int i, failedBefore;
+
+    syx2insInit();
+    if (!mkdtemp(tempDir))
+    {
+        printf("Can't create a temporary directory\n");
+        return 1;
+    }
+
+    for (i = 0; tests[i].name; i++)
+    {
+        printf("%s\n", tests[i].name);
+        failedBefore = nFailed;
+        tests[i].run();
+        printf("    %s\n", nFailed == failedBefore ? "ok" : "FAILED");
+    }
+
+    sprintf(command, "rm -rf %s", tempDir);
+    if (system(command) != 0)
+        printf("Couldn't remove %s\n", tempDir);
+    free(toolOutput);
+    printf("\n%d checks, %d failed.\n", nChecks, nFailed);
+    return nFailed != 0;
+}
@@ -0,0 +1,483 @@
+/********************************************************************************
+*	SYX2INS timbre index							*
+*									*
+*	See timbreidx.h for the file layout.				*
+********************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
+#include "timbreidx.h"
+#include "cache.h"
+
+#define INDEX_MAGIC     0x49543253      //"S2TI"
+#define INDEX_FORMAT    3
+#define SEARCH_BLOCK    32              //Records one search step compares against
+
+static uint32_t bucketOf(uint64_t hash, uint32_t bucketBits)
+{
+    return bucketBits ? (uint32_t)(hash >> (64 - bucketBits)) : 0;
+}
+
+/* Where the records start. The bucket table is padded so their uint64_t hashes
+are aligned whatever the number of buckets. */
+static size_t recordsOffset(uint32_t bucketBits)
+{
+    size_t end = sizeof(TimbreIndexHeader) + (((size_t)1 << bucketBits) + 1) * sizeof(uint32_t);
+
+    return (end + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+}
+
+/* The sizes add up, now make sure nothing in the tables points outside them, so
+a damaged or foreign file can't make lookups read past the mapping */
+static int checkTables(const TimbreIndex *index)
+{
+    const TimbreIndexHeader *header = index->header;
+    size_t nBuckets = (size_t)1 << header->bucketBits, i;
+
+    if ((uintptr_t)index->records % sizeof(uint64_t))
+        return 0;
+    if (index->buckets[0] != 0 || index->buckets[nBuckets] != header->nRecords)
+        return 0;
+    for (i = 0; i < nBuckets; i++)
+        if (index->buckets[i] > index->buckets[i + 1])
+            return 0;
+    for (i = 0; i < header->nFiles; i++)
+        if (index->files[i] >= header->stringsSize)
+            return 0;
+    return header->nFiles == 0 || index->strings[header->stringsSize - 1] == 0;
+}
+
+int timbreIndexOpen(TimbreIndex *index, const char *path)
+{
+    const TimbreIndexHeader *header;
+    struct stat info;
+    size_t need;
+    int fd;
+
+    memset(index, 0, sizeof(*index));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(TimbreIndexHeader))
+    {
+        close(fd);
+        return 0;
+    }
+
+    index->base = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (index->base == MAP_FAILED)
+    {
+        index->base = 0;
+        return 0;
+    }
+    index->size = info.st_size;
+
+    header = index->base;
+    /* Shifting by more than 31 is undefined, such files fail the check below anyway */
+    need = header->bucketBits > 31 ? 0 : recordsOffset(header->bucketBits)
+        + (size_t)header->nRecords * sizeof(TimbreRecord) + (size_t)header->featureStride * SYX2INS_TIMBRE_FEATURES
+        + (size_t)header->nFiles * sizeof(uint32_t) + header->stringsSize;
+    if (header->magic != INDEX_MAGIC || header->format != INDEX_FORMAT || header->bucketBits > 31 || need != index->size
+        || header->featureStride < header->nRecords || header->featureStride % SEARCH_BLOCK)
+    {
+        timbreIndexClose(index);
+        return 0;
+    }
+
+    index->header = header;
+    index->buckets = (const uint32_t *)(header + 1);
+    index->records = (const TimbreRecord *)((const unsigned char *)index->base + recordsOffset(header->bucketBits));
+    index->features = (const unsigned char *)(index->records + header->nRecords);
+    index->files = (const uint32_t *)(index->features + (size_t)header->featureStride * SYX2INS_TIMBRE_FEATURES);
+    index->strings = (const char *)(index->files + header->nFiles);
+
+    if (!checkTables(index))
+    {
+        timbreIndexClose(index);
+        return 0;
+    }
+    return 1;
+}
+
+void timbreIndexClose(TimbreIndex *index)
+{
+    if (index->base)
+        munmap((void *)index->base, index->size);
+    memset(index, 0, sizeof(*index));
+}
+
+size_t timbreIndexFind(const TimbreIndex *index, uint64_t hash, const TimbreRecord **first)
+{
+    uint32_t bucket = bucketOf(hash, index->header->bucketBits);
+    uint32_t r = index->buckets[bucket], end = index->buckets[bucket + 1];
+    size_t n = 0;
+
+    /* A bucket holds about one record, the few in there are sorted by hash */
+    for (; r < end && index->records[r].hash < hash; r++)
+        ;
+    *first = &index->records[r];
+    for (; r < end && index->records[r].hash == hash; r++)
+        n++;
+    return n;
+}
+
+const char *timbreIndexFile(const TimbreIndex *index, uint32_t file)
+{
+    return file < index->header->nFiles ? index->strings + index->files[file] : "";
+}
+
+/* ********************************************************************* */
+/* Similarity search. Each step works out the distance from the wanted features
+to SEARCH_BLOCK records, one feature row at a time. Features are 0-255 and there
+are fewer than 258 of them, so a distance always fits 16 bits. */
+
+typedef void (*BlockDistances)(const unsigned char *column, size_t stride, const unsigned char *features, uint16_t distances[SEARCH_BLOCK]);
+
+static void blockDistancesScalar(const unsigned char *column, size_t stride, const unsigned char *features, uint16_t distances[SEARCH_BLOCK])
+{
+    const unsigned char *row;
+    int f, r;
+
+    memset(distances, 0, SEARCH_BLOCK * sizeof(*distances));
+    for (f = 0; f < SYX2INS_TIMBRE_FEATURES; f++)
+    {
+        row = column + (size_t)f * stride;
+        for (r = 0; r < SEARCH_BLOCK; r++)
+            distances[r] += row[r] > features[f] ? row[r] - features[f] : features[f] - row[r];
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SEARCH
+
+__attribute__((target("sse2")))
+static void blockDistancesSSE2(const unsigned char *column, size_t stride, const unsigned char *features, uint16_t distances[SEARCH_BLOCK])
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum0 = zero, sum1 = zero, sum2 = zero, sum3 = zero;
+    __m128i want, a, b;
+    const unsigned char *row;
+    int f;
+
+    for (f = 0; f < SYX2INS_TIMBRE_FEATURES; f++)
+    {
+        row = column + (size_t)f * stride;
+        want = _mm_set1_epi8((char)features[f]);
+        a = _mm_loadu_si128((const __m128i *)row);
+        b = _mm_loadu_si128((const __m128i *)(row + 16));
+        /* |x - y| of unsigned bytes is whichever saturating difference isn't 0 */
+        a = _mm_or_si128(_mm_subs_epu8(a, want), _mm_subs_epu8(want, a));
+        b = _mm_or_si128(_mm_subs_epu8(b, want), _mm_subs_epu8(want, b));
+        sum0 = _mm_add_epi16(sum0, _mm_unpacklo_epi8(a, zero));
+        sum1 = _mm_add_epi16(sum1, _mm_unpackhi_epi8(a, zero));
+        sum2 = _mm_add_epi16(sum2, _mm_unpacklo_epi8(b, zero));
+        sum3 = _mm_add_epi16(sum3, _mm_unpackhi_epi8(b, zero));
+    }
+    _mm_storeu_si128((__m128i *)&distances[0], sum0);
+    _mm_storeu_si128((__m128i *)&distances[8], sum1);
+    _mm_storeu_si128((__m128i *)&distances[16], sum2);
+    _mm_storeu_si128((__m128i *)&distances[24], sum3);
+}
+
+__attribute__((target("avx2")))
+static void blockDistancesAVX2(const unsigned char *column, size_t stride, const unsigned char *features, uint16_t distances[SEARCH_BLOCK])
+{
+    __m256i sum0 = _mm256_setzero_si256(), sum1 = _mm256_setzero_si256();
+    __m256i want, a;
+    const unsigned char *row;
+    int f;
+
+    for (f = 0; f < SYX2INS_TIMBRE_FEATURES; f++)
+    {
+        row = column + (size_t)f * stride;
+        want = _mm256_set1_epi8((char)features[f]);
+        a = _mm256_loadu_si256((const __m256i *)row);
+        a = _mm256_or_si256(_mm256_subs_epu8(a, want), _mm256_subs_epu8(want, a));
+        /* Widen each half in order, unpacking would interleave the 128 bit lanes */
+        sum0 = _mm256_add_epi16(sum0, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(a)));
+        sum1 = _mm256_add_epi16(sum1, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(a, 1)));
+    }
+    _mm256_storeu_si256((__m256i *)&distances[0], sum0);
+    _mm256_storeu_si256((__m256i *)&distances[16], sum1);
+}
+#endif
+
+static BlockDistances pickBlockDistances(void)
+{
+#ifdef HAVE_X86_SEARCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return blockDistancesAVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return blockDistancesSSE2;
+#endif
+    return blockDistancesScalar;
+}
+
+/* Names timbre editors and games give a slot nobody named */
+static const char *placeholderNames[] =
+{
+    "NEW TIMBRE", "NEWTIMBRE", "TIMBRE", "UNTITLED", "NO NAME", "NONAME", "INIT", "INITIAL", "EMPTY", "DUMMY"
+};
+
+/* Blank names, placeholders and names without a single letter or digit ("-",
+"----------") are what dumps leave in unused slots, they're no use as a suggestion */
+static int hasName(const TimbreRecord *record)
+{
+    char name[sizeof(record->name) + 1];
+    size_t length = 0, start, i;
+    int hasAlnum = 0;
+
+    for (i = 0; i < sizeof(record->name) && record->name[i]; i++)
+    {
+        name[length++] = toupper((unsigned char)record->name[i]);
+        hasAlnum |= isalnum((unsigned char)record->name[i]) != 0;
+    }
+    if (!hasAlnum)
+        return 0;
+    while (length && name[length - 1] == ' ')
+        length--;
+    for (start = 0; name[start] == ' '; start++)
+        ;
+    name[length] = 0;
+
+    for (i = 0; i < sizeof(placeholderNames) / sizeof(*placeholderNames); i++)
+        if (!strcmp(name + start, placeholderNames[i]))
+            return 0;
+    return 1;
+}
+
+int timbreIndexNearest(const TimbreIndex *index, const unsigned char *features, uint32_t skipFile, unsigned maxDistance,
+    const TimbreRecord **nearest, unsigned *distance)
+{
+    static BlockDistances blockDistances;
+    uint16_t distances[SEARCH_BLOCK];
+    uint32_t nRecords = index->header->nRecords, block, r;
+    unsigned best = maxDistance + 1;
+
+    if (!blockDistances)
+        blockDistances = pickBlockDistances();
+
+    *nearest = 0;
+    for (block = 0; block < nRecords; block += SEARCH_BLOCK)
+    {
+        blockDistances(index->features + block, index->header->featureStride, features, distances);
+        for (r = 0; r < SEARCH_BLOCK && block + r < nRecords; r++)
+        {
+            if (distances[r] >= best)
+                continue;
+            if (index->records[block + r].file == skipFile || !hasName(&index->records[block + r]))
+                continue;
+            best = distances[r];
+            *nearest = &index->records[block + r];
+        }
+    }
+    *distance = best;
+    return *nearest != 0;
+}
+
+void timbreIndexBuilderInit(TimbreIndexBuilder *builder)
+{
+    memset(builder, 0, sizeof(*builder));
+}
+
+void timbreIndexBuilderFree(TimbreIndexBuilder *builder)
+{
+    size_t i;
+
+    for (i = 0; i < builder->nFiles; i++)
+        free(builder->files[i]);
+    free(builder->files);
+    free(builder->records);
+    free(builder->features);
+    memset(builder, 0, sizeof(*builder));
+}
+
+static uint32_t addFileName(TimbreIndexBuilder *builder, const char *path)
+{
+    if (builder->nFiles == builder->fileCapacity)
+    {
+        builder->fileCapacity = builder->fileCapacity ? builder->fileCapacity * 2 : 256;
+        builder->files = realloc(builder->files, builder->fileCapacity * sizeof(*builder->files));
+    }
+    builder->files[builder->nFiles] = strdup(path);
+    return (uint32_t)builder->nFiles++;
+}
+
+static void addRecord(TimbreIndexBuilder *builder, uint64_t hash, uint32_t file, uint16_t slot, const char *name, const unsigned char *features)
+{
+    TimbreRecord *record;
+
+    if (builder->nRecords == builder->recordCapacity)
+    {
+        builder->recordCapacity = builder->recordCapacity ? builder->recordCapacity * 2 : 1024;
+        builder->records = realloc(builder->records, builder->recordCapacity * sizeof(*builder->records));
+        builder->features = realloc(builder->features, builder->recordCapacity * sizeof(*builder->features));
+    }
+    memcpy(builder->features[builder->nRecords], features, SYX2INS_TIMBRE_FEATURES);
+    record = &builder->records[builder->nRecords++];
+    memset(record, 0, sizeof(*record));
+    record->hash = hash;
+    record->file = file;
+    record->slot = slot;
+    memcpy(record->name, name, sizeof(record->name));
+}
+
+void timbreIndexAddFile(TimbreIndexBuilder *builder, const char *path, const Syx2InsResult *result)
+{
+    uint32_t file = addFileName(builder, path);
+    int i;
+
+    for (i = 0; i < 64; i++)
+        if (result->timbreWritten[i])
+            addRecord(builder, result->timbreHash[i], file, i, result->timbreNames[i], result->timbreFeatures[i]);
+}
+
+static int compareNames(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+void timbreIndexKeepOld(TimbreIndexBuilder *builder, const TimbreIndex *old)
+{
+    char **fresh = malloc((builder->nFiles + 1) * sizeof(*fresh));
+    uint32_t *renumber = malloc((old->header->nFiles + 1) * sizeof(*renumber));
+    unsigned char features[SYX2INS_TIMBRE_FEATURES];
+    const char *name;
+    uint32_t f, r;
+
+    /* Files added this time replace whatever the old index knew about them */
+    memcpy(fresh, builder->files, builder->nFiles * sizeof(*fresh));
+    qsort(fresh, builder->nFiles, sizeof(*fresh), compareNames);
+
+    for (f = 0; f < old->header->nFiles; f++)
+    {
+        name = timbreIndexFile(old, f);
+        renumber[f] = bsearch(&name, fresh, builder->nFiles, sizeof(*fresh), compareNames) ? UINT32_MAX : addFileName(builder, name);
+    }
+
+    for (r = 0; r < old->header->nRecords; r++)
+    {
+        const TimbreRecord *record = &old->records[r];
+
+        if (record->file < old->header->nFiles && renumber[record->file] != UINT32_MAX)
+        {
+            for (f = 0; f < SYX2INS_TIMBRE_FEATURES; f++)
+                features[f] = old->features[(size_t)f * old->header->featureStride + r];
+            addRecord(builder, record->hash, renumber[record->file], record->slot, record->name, features);
+        }
+    }
+
+    free(fresh);
+    free(renumber);
+}
+
+/* A record and where its features are in the builder, so sorting can take them along */
+typedef struct
+{
+    TimbreRecord record;
+    size_t features;
+} SortedRecord;
+
+static int compareRecords(const void *a, const void *b)
+{
+    const TimbreRecord *ra = &((const SortedRecord *)a)->record, *rb = &((const SortedRecord *)b)->record;
+
+    if (ra->hash != rb->hash)
+        return ra->hash < rb->hash ? -1 : 1;
+    if (ra->file != rb->file)
+        return ra->file < rb->file ? -1 : 1;
+    return (int)ra->slot - (int)rb->slot;
+}
+
+int timbreIndexWrite(TimbreIndexBuilder *builder, const char *path)
+{
+    TimbreIndexHeader header;
+    SortedRecord *sorted;
+    uint32_t *buckets, *files;
+    size_t nBuckets, stringsSize = 0, size, i, r, f;
+    unsigned char *image, *p;
+    int ok;
+
+    sorted = malloc((builder->nRecords + 1) * sizeof(*sorted));
+    if (!sorted)
+        return 0;
+    for (r = 0; r < builder->nRecords; r++)
+    {
+        sorted[r].record = builder->records[r];
+        sorted[r].features = r;
+    }
+    qsort(sorted, builder->nRecords, sizeof(*sorted), compareRecords);
+
+    /* About one record per bucket */
+    memset(&header, 0, sizeof(header));
+    header.magic = INDEX_MAGIC;
+    header.format = INDEX_FORMAT;
+    while (header.bucketBits < 31 && ((size_t)1 << header.bucketBits) < builder->nRecords)
+        header.bucketBits++;
+    header.nRecords = builder->nRecords;
+    header.nFiles = builder->nFiles;
+    for (i = 0; i < builder->nFiles; i++)
+        stringsSize += strlen(builder->files[i]) + 1;
+    header.stringsSize = stringsSize;
+    header.featureStride = (builder->nRecords + SEARCH_BLOCK - 1) / SEARCH_BLOCK * SEARCH_BLOCK;
+    nBuckets = (size_t)1 << header.bucketBits;
+
+    size = recordsOffset(header.bucketBits) + builder->nRecords * sizeof(TimbreRecord)
+        + (size_t)header.featureStride * SYX2INS_TIMBRE_FEATURES + builder->nFiles * sizeof(uint32_t) + stringsSize;
+    image = calloc(1, size);
+    if (!image)
+    {
+        free(sorted);
+        return 0;
+    }
+
+    p = image;
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+
+    /* Records are sorted by hash, so bucket starts only ever move forward */
+    buckets = (uint32_t *)p;
+    for (i = 0, r = 0; i <= nBuckets; i++)
+    {
+        while (r < builder->nRecords && bucketOf(sorted[r].record.hash, header.bucketBits) < i)
+            r++;
+        buckets[i] = r;
+    }
+    buckets[nBuckets] = builder->nRecords;
+    p = image + recordsOffset(header.bucketBits);
+
+    for (r = 0; r < builder->nRecords; r++)
+        memcpy(p + r * sizeof(TimbreRecord), &sorted[r].record, sizeof(TimbreRecord));
+    p += builder->nRecords * sizeof(TimbreRecord);
+
+    /* Turned around to one row per feature, the padding past the last record stays 0 */
+    for (f = 0; f < SYX2INS_TIMBRE_FEATURES; f++)
+        for (r = 0; r < builder->nRecords; r++)
+            p[f * header.featureStride + r] = builder->features[sorted[r].features][f];
+    p += (size_t)header.featureStride * SYX2INS_TIMBRE_FEATURES;
+
+    files = (uint32_t *)p;
+    p += builder->nFiles * sizeof(uint32_t);
+    for (i = 0; i < builder->nFiles; i++)
+    {
+        files[i] = (uint32_t)(p - (unsigned char *)(files + builder->nFiles));
+        strcpy((char *)p, builder->files[i]);
+        p += strlen(builder->files[i]) + 1;
+    }
+
+    ok = writeFileAtomic(path, image, size);
+    free(image);
+    free(sorted);
+    return ok;
+}
@@ -0,0 +1,110 @@
+/********************************************************************************
+*	SYX2INS timbre index							*
+*									*
+*	A persistent index of every custom timbre seen in a corpus of	*
+*	dumps, keyed by the hash of its parameters (the name is left out,	*
+*	so renamed copies of the same sound end up together). The file is	*
+*	laid out to be used straight from an mmap():			*
+*									*
+*	  header							*
+*	  bucket table    nBuckets+1 x uint32, first record of each bucket	*
+*	                  then zeros up to a multiple of 8 bytes		*
+*	  records         nRecords x TimbreRecord, sorted by hash		*
+*	  features        SYX2INS_TIMBRE_FEATURES rows of featureStride	*
+*	                  bytes, row f holds feature f of every record	*
+*	  file table      nFiles x uint32, offset of each path		*
+*	  strings         NULL terminated paths				*
+*									*
+*	A lookup takes the top bits of the hash as bucket number and only	*
+*	looks at the few records in that bucket.				*
+*									*
+*	The features are stored column per record so a nearest		*
+*	neighbour search can compare one timbre against 16 or 32 records	*
+*	at once with SSE2 or AVX2, adding up absolute differences.	*
+********************************************************************************/
+#ifndef SYX2INS_TIMBREIDX_H
+#define SYX2INS_TIMBREIDX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "syx2ins.h"
+
+/* One place a timbre was found: which file, which Memory slot, under what name */
+typedef struct
+{
+    uint64_t hash;
+    uint32_t file;                  //Index into the file table
+    uint16_t slot;                  //Timbre memory slot 0-63
+    char name[10];                  //Not NULL terminated
+} TimbreRecord;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t format;
+    uint32_t bucketBits;
+    uint32_t nRecords;
+    uint32_t nFiles;
+    uint32_t stringsSize;
+    uint32_t featureStride;         //nRecords rounded up to a whole number of search blocks
+} TimbreIndexHeader;
+
+/* An index file mapped read-only */
+typedef struct
+{
+    const void *base;
+    size_t size;
+    const TimbreIndexHeader *header;
+    const uint32_t *buckets;
+    const TimbreRecord *records;
+    const unsigned char *features;
+    const uint32_t *files;
+    const char *strings;
+} TimbreIndex;
+
+/* Map an index file. Returns 0 if it doesn't exist or isn't a valid index. */
+int timbreIndexOpen(TimbreIndex *index, const char *path);
+void timbreIndexClose(TimbreIndex *index);
+
+/* All records with this hash are next to each other. Returns how many there are
+and points first at the first one. */
+size_t timbreIndexFind(const TimbreIndex *index, uint64_t hash, const TimbreRecord **first);
+const char *timbreIndexFile(const TimbreIndex *index, uint32_t file);
+
+/* Farthest a timbre may be from another to still count as sounding like it: an
+average difference of 8 out of 255 per parameter */
+#define TIMBRE_SIMILAR_DISTANCE     (SYX2INS_TIMBRE_FEATURES * 8)
+
+/* The record with a real name that sounds closest to a timbre's features (from
+Syx2InsResult.timbreFeatures), at most maxDistance away, leaving out records of
+skipFile (UINT32_MAX to keep them all). Blank names and placeholders editors
+leave behind, like NEW TIMBRE, don't count as names. distance is the sum of
+absolute feature differences, 0 for the same sound. Returns 0 if nothing close
+enough has a name. */
+int timbreIndexNearest(const TimbreIndex *index, const unsigned char *features, uint32_t skipFile, unsigned maxDistance,
+    const TimbreRecord **nearest, unsigned *distance);
+
+/* Collects records in memory before writing a new index */
+typedef struct
+{
+    TimbreRecord *records;
+    unsigned char (*features)[SYX2INS_TIMBRE_FEATURES];    //Of each record, same order
+    size_t nRecords, recordCapacity;
+    char **files;
+    size_t nFiles, fileCapacity;
+} TimbreIndexBuilder;
+
+void timbreIndexBuilderInit(TimbreIndexBuilder *builder);
+void timbreIndexBuilderFree(TimbreIndexBuilder *builder);
+
+/* Add every custom timbre the dump set */
+void timbreIndexAddFile(TimbreIndexBuilder *builder, const char *path, const Syx2InsResult *result);
+
+/* Carry over the records of an existing index for files that weren't added again */
+void timbreIndexKeepOld(TimbreIndexBuilder *builder, const TimbreIndex *old);
+
+/* Sort, bucket and write the index atomically. Returns 0 on failure. */
+int timbreIndexWrite(TimbreIndexBuilder *builder, const char *path);
+
+#endif